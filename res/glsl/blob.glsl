@@ -2,9 +2,6 @@
 #define BLOB_GLSL
 
 
-#define max_blob_count 32
-
-
 #define sdf_sphere 0x0
 #define sdf_cube   0x1
 
@@ -17,15 +14,28 @@
 #define sdf_smooth_intersect    0x5
 
 
+// Moves every tick, kept out of anything baked (blob_flag_dynamic in blob.hpp)
+#define blob_flag_dynamic 0x1
+
+// Same layout as blob in blob.hpp and in scene files
 struct blob {
-    // Add rotations later
+    // w: radius of a sphere around position which bounds the surface
     vec4 position;
+    // xyz: cube half extents, w: sphere radius / cube rounding
     vec4 scale;
+    // Quaternion as xyzw
+    vec4 rotation;
     uint type;
     uint op;
-    uint pad0;
-    uint pad1;
+    uint material;
+    uint flags;
 };
 
+// Rotates v by the inverse of the unit quaternion q (world to blob space)
+vec3 inverse_rotate(in vec4 q, in vec3 v) {
+    vec3 u = -q.xyz;
+    return v + 2.0 * cross(u, cross(u, v) + q.w * v);
+}
+
 
 #endif
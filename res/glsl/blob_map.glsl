@@ -0,0 +1,189 @@
+#ifndef BLOB_MAP_GLSL
+#define BLOB_MAP_GLSL
+
+#include "lbvh.glsl"
+
+// The analytic field of the blobs, walking the BVH. Whoever includes this
+// declares the blob_data (ublobs) and blob_bvh (ubvh) buffers first.
+
+// Same as blob_smoothing in blob.hpp
+#define blob_smoothing 0.25
+
+// Depth is bounded by the 30 Morton bits plus the index bits for equal keys
+#define bvh_stack_size 64
+
+float op_union(float d1, float d2) {
+    return min(d1, d2);
+}
+
+float op_sub(float d1, float d2) { 
+    return max(-d1, d2);
+}
+
+float op_intersect(float d1, float d2) {
+    return max(d1, d2);
+}
+
+float op_smooth_union(float d1, float d2, float k) {
+    float h = max(k - abs(d1 - d2), 0.0);
+    return min(d1, d2) - h * h * 0.25 / k;
+}
+
+float op_smooth_sub(float d1, float d2, float k) {
+    return -op_smooth_union(d1, -d2, k);
+}
+
+float op_smooth_intersect(float d1, float d2, float k) {
+    return -op_smooth_union(-d1, -d2, k);
+}
+
+float sphere(in vec3 p, in float r) {
+    return length(p) - r;
+}
+
+float cube(vec3 p, vec3 b, float r) {
+    vec3 d = abs(p) - b;
+    return min(max(d.x, max(d.y, d.z)), 0.0) + length(max(d, 0.0)) - r;
+}
+
+float blob_distance(in blob b, in vec3 pos) {
+    switch (b.type) {
+    case sdf_sphere: return sphere(pos - b.position.xyz, b.scale.w);
+    case sdf_cube: return cube(inverse_rotate(b.rotation, pos - b.position.xyz), b.scale.xyz, b.scale.w);
+    default: return 1e10;
+    }
+}
+
+/* Whether the distance to a surface inside the sphere is at least bound,
+ * from a single dot product. Skipping a blob this way is exact: an addition
+ * with distance >= d + k leaves the smooth union at d, a subtraction with
+ * distance >= k - d leaves the smooth subtraction at d. */
+bool is_sphere_beyond(in vec3 pos, in vec3 center, float radius, float bound) {
+    vec3 v = pos - center;
+    float r = bound + radius;
+    return r <= 0.0 || dot(v, v) >= r * r;
+}
+
+bool is_blob_beyond(in blob b, in vec3 pos, float bound) {
+    return is_sphere_beyond(pos, b.position.xyz, b.position.w, bound);
+}
+
+// d with the blob smoothly added, without evaluating it when it's too far to matter
+float add_blob(in blob b, in vec3 pos, float d) {
+    if (is_blob_beyond(b, pos, d + blob_smoothing)) {
+        return d;
+    }
+
+    return op_smooth_union(blob_distance(b, pos), d, blob_smoothing);
+}
+
+float sub_blob(in blob b, in vec3 pos, float d) {
+    if (is_blob_beyond(b, pos, blob_smoothing - d)) {
+        return d;
+    }
+
+    return op_smooth_sub(blob_distance(b, pos), d, blob_smoothing);
+}
+
+// Distance to the node's box, a lower bound for every blob below it
+float node_distance(uint node, in vec3 pos) {
+    vec3 q = max(max(ubvh.nodes[node].lo - pos, pos - ubvh.nodes[node].hi), vec3(0.0));
+    return length(q);
+}
+
+/* Whether the blobs below a node can still change d. An addition with
+ * distance >= d + k leaves the smooth union at d, a subtraction with
+ * distance >= k - d leaves the smooth subtraction at d. */
+bool is_node_relevant(uint node, in vec3 pos, float d, uint mask) {
+    if ((ubvh.nodes[node].mask & mask) == 0) {
+        return false;
+    }
+
+    float bound = (mask & bvh_has_add) != 0 ? d + blob_smoothing : blob_smoothing - d;
+    return node_distance(node, pos) < bound;
+}
+
+// Visits the additions (or subtractions) which are close enough, nearer child first
+float traverse_bvh(in vec3 pos, float d, uint mask) {
+    uint stack[bvh_stack_size];
+    uint top = 0;
+
+    uint node = 0;
+    if (!is_node_relevant(node, pos, d, mask)) {
+        return d;
+    }
+
+    for (;;) {
+        if (node >= ubvh.leaf_offset) {
+            blob b = ublobs.blobs[ubvh.nodes[node].left];
+            d = (mask & bvh_has_add) != 0 ? add_blob(b, pos, d) : sub_blob(b, pos, d);
+        }
+        else {
+            uint left = ubvh.nodes[node].left;
+            uint right = ubvh.nodes[node].right;
+            bool is_left_relevant = is_node_relevant(left, pos, d, mask);
+            bool is_right_relevant = is_node_relevant(right, pos, d, mask);
+
+            if (is_left_relevant && is_right_relevant) {
+                bool is_left_nearer = node_distance(left, pos) < node_distance(right, pos);
+                node = is_left_nearer ? left : right;
+                stack[top++] = is_left_nearer ? right : left;
+                continue;
+            }
+
+            if (is_left_relevant || is_right_relevant) {
+                node = is_left_relevant ? left : right;
+                continue;
+            }
+        }
+
+        // d only ever tightens the bound, deferred nodes get checked again
+        bool is_found = false;
+        while (top > 0 && !is_found) {
+            node = stack[--top];
+            is_found = is_node_relevant(node, pos, d, mask);
+        }
+
+        if (!is_found) {
+            break;
+        }
+    }
+
+    return d;
+}
+
+// Additions first, then the subtractions. mask picks the kind of blobs
+// (bvh_has_add | bvh_has_sub for all of them)
+float map_blobs(in vec3 pos, uint mask) {
+    float d = 1e10;
+    if (ubvh.node_count == 0) {
+        return d;
+    }
+
+    d = traverse_bvh(pos, d, mask & bvh_has_add);
+    d = traverse_bvh(pos, d, mask & bvh_has_sub);
+
+    return d;
+}
+
+float map_blobs(in vec3 pos) {
+    return map_blobs(pos, bvh_has_add | bvh_has_sub);
+}
+
+float map_static_blobs(in vec3 pos) {
+    return map_blobs(pos, bvh_static_add | bvh_static_sub);
+}
+
+/* Combines the dynamic blobs with the field of the static ones (sampled
+ * from a cache). The dynamic subtractions come after all additions as
+ * usual, the dynamic additions after the static subtractions though. */
+float map_dynamic_blobs(in vec3 pos, float static_d) {
+    if (ubvh.node_count == 0) {
+        return static_d;
+    }
+
+    float d = traverse_bvh(pos, static_d, bvh_dynamic_add);
+    return traverse_bvh(pos, d, bvh_dynamic_sub);
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef BRICK_GLSL
+#define BRICK_GLSL
+
+/* Sparse brick cache of the blob field (brick_map_pass.cpp). A grid of
+ * cells covers a fixed region, cells near the surface point to an 8^3 brick
+ * of distance samples in the atlas, the others only keep a distance bound.
+ * Only the static blobs get baked, the dynamic ones are added on top when
+ * sampling. The samples of a brick sit on the cell's corners and edges, so neighbouring
+ * bricks share their border and trilinear filtering stays continuous. */
+
+#define brick_grid_size 32
+#define brick_cell_size 0.25
+#define brick_voxels 8
+// In bricks, 32 * 32 * 8 of them
+#define brick_atlas_size uvec3(32, 32, 8)
+
+const vec3 brick_grid_lo = vec3(-4.0, -2.0, -4.0);
+
+// Filtering only has a few bits of sub-voxel precision, normal taps have to be wider
+#define brick_normal_epsilon 0.01
+
+// Empty cells store at most this, so edits only invalidate cells this close
+#define brick_max_empty_distance 0.5
+
+// Cell states other than a brick index
+#define brick_none 0xffffffffu
+// Wants a brick, brick_bake allocates it
+#define brick_pending 0xfffffffeu
+// Near the surface but the atlas is full, falls back to the blobs
+#define brick_analytic 0xfffffffdu
+
+struct brick_cell {
+    uint brick;
+    // Lower bound of |distance| inside the cell (with the sign), for cells without a brick
+    float distance;
+    // Last bake which classified the cell
+    uint stamp;
+    uint pad;
+};
+
+bool is_brick(uint brick) {
+    return brick < brick_analytic;
+}
+
+uint brick_cell_index(uvec3 cell) {
+    return cell.x + (cell.y + cell.z * brick_grid_size) * brick_grid_size;
+}
+
+uvec3 brick_cell_coords(uint idx) {
+    return uvec3(idx % brick_grid_size, (idx / brick_grid_size) % brick_grid_size, idx / (brick_grid_size * brick_grid_size));
+}
+
+vec3 brick_cell_lo(uvec3 cell) {
+    return brick_grid_lo + vec3(cell) * brick_cell_size;
+}
+
+// First voxel of the brick in the atlas
+uvec3 brick_atlas_origin(uint brick) {
+    uvec3 coords = uvec3(
+        brick % brick_atlas_size.x,
+        (brick / brick_atlas_size.x) % brick_atlas_size.y,
+        brick / (brick_atlas_size.x * brick_atlas_size.y));
+
+    return coords * brick_voxels;
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef CAMERA_GLSL
+#define CAMERA_GLSL
+
+// Fixed camera of blob_cast, shared with the tile classification
+
+#define camera_near 7.0
+#define camera_far 11.0
+
+const vec3 camera_origin = vec3(0.0, 4.0, 8.0);
+
+// Frag coords have y going up
+vec2 camera_screen_point(vec2 frag_coord, vec2 resolution) {
+    return (-resolution + 2.0 * frag_coord) / resolution.y;
+}
+
+// Not normalized, the ray through p stays linear in p
+vec3 camera_direction(vec2 p) {
+    return vec3(p - vec2(0.0, 1.8), -3.5);
+}
+
+#endif
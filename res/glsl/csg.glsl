@@ -0,0 +1,77 @@
+#ifndef CSG_GLSL
+#define CSG_GLSL
+
+// Interpreter of the CSG bytecode (csg.hpp has the compiler). Whoever
+// includes this declares the blob_data (ublobs) and csg_program (ucsg)
+// buffers and includes blob_map.glsl first. Instructions are uvec2s of
+// x: opcode (3 bits), dst (4), a (4), b (4), blob operand (1), smoothing
+// as a half float (16) and y: the blob of the operand.
+
+#define csg_load                0x0
+#define csg_union               0x1
+#define csg_sub                 0x2
+#define csg_intersect           0x3
+#define csg_smooth_union        0x4
+#define csg_smooth_sub          0x5
+#define csg_smooth_intersect    0x6
+
+#define csg_register_count 16
+#define csg_code_blob_operand (1u << 15)
+
+// Whether the blob operand is far enough to leave a as it is (see is_sphere_beyond).
+// Intersections always need the blob
+bool is_blob_operand_beyond(uint opcode, float a, float k, in blob b, in vec3 pos) {
+    switch (opcode) {
+    case csg_union: return is_blob_beyond(b, pos, a);
+    case csg_sub: return is_blob_beyond(b, pos, -a);
+    case csg_smooth_union: return is_blob_beyond(b, pos, a + k);
+    case csg_smooth_sub: return is_blob_beyond(b, pos, k - a);
+    default: return false;
+    }
+}
+
+float run_csg_program(in vec3 pos) {
+    if (ucsg.instruction_count == 0) {
+        return 1e10;
+    }
+
+    float registers[csg_register_count];
+
+    for (uint i = 0; i < ucsg.instruction_count; ++i) {
+        uvec2 instruction = ucsg.code[i];
+        uint code = instruction.x;
+
+        uint opcode = code & 0x7u;
+        uint dst = (code >> 3) & 0xfu;
+        float k = unpackHalf2x16(code >> 16).x;
+
+        bool is_blob_operand = opcode == csg_load || (code & csg_code_blob_operand) != 0;
+        float a = registers[(code >> 7) & 0xfu];
+
+        if (is_blob_operand && opcode != csg_load && is_blob_operand_beyond(opcode, a, k, ublobs.blobs[instruction.y], pos)) {
+            registers[dst] = a;
+            continue;
+        }
+
+        float b = is_blob_operand ? blob_distance(ublobs.blobs[instruction.y], pos) : registers[(code >> 11) & 0xfu];
+
+        float d;
+        switch (opcode) {
+        case csg_load: d = b; break;
+        case csg_union: d = op_union(a, b); break;
+        // Subtracts b from a, the op_ helpers take the subtrahend first
+        case csg_sub: d = op_sub(b, a); break;
+        case csg_intersect: d = op_intersect(a, b); break;
+        case csg_smooth_union: d = op_smooth_union(a, b, k); break;
+        case csg_smooth_sub: d = op_smooth_sub(b, a, k); break;
+        case csg_smooth_intersect: d = op_smooth_intersect(a, b, k); break;
+        default: d = a; break;
+        }
+
+        registers[dst] = d;
+    }
+
+    return registers[ucsg.result_register];
+}
+
+#endif
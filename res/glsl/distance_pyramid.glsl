@@ -0,0 +1,22 @@
+#ifndef DISTANCE_PYRAMID_GLSL
+#define DISTANCE_PYRAMID_GLSL
+
+/* Mip chain of distance bounds over the static blobs (distance_pyramid_pass.cpp).
+ * A texel of level 0 holds a lower bound of the distance from anything in
+ * its cell to the static surface, every level above holds the min of the 8
+ * texels below it. A texel above zero means its whole cell is free of it.
+ *
+ * The region gets fitted to the static blobs whenever it's built, shaders
+ * get it as a push constant and define pyramid_region to it before using
+ * anything below (xyz: low corner, w: size of a level 0 cell). */
+
+#define pyramid_size 32
+#define pyramid_level_count 5
+
+#define pyramid_lo (pyramid_region.xyz)
+#define pyramid_cell_size (pyramid_region.w)
+
+// Bounds below this don't count as empty, they're within the field's error
+#define pyramid_empty_epsilon 0.01
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef LBVH_GLSL
+#define LBVH_GLSL
+
+#include "blob.glsl"
+
+// Linear BVH over the blobs (lbvh_pass.cpp). For n blobs, nodes [0, n - 1)
+// are internal with node 0 as the root, nodes [n - 1, 2n - 1) are the
+// leaves in Morton order. With a single blob, the root is its leaf.
+
+// Node masks keep static and dynamic blobs apart (blob_flag_dynamic), so a
+// traversal can look at only one kind
+#define bvh_static_add 0x1
+#define bvh_static_sub 0x2
+#define bvh_dynamic_add 0x4
+#define bvh_dynamic_sub 0x8
+
+#define bvh_has_add (bvh_static_add | bvh_dynamic_add)
+#define bvh_has_sub (bvh_static_sub | bvh_dynamic_sub)
+
+#define bvh_no_parent 0xffffffff
+
+struct bvh_node {
+    vec3 lo;
+    // bvh_static_add etc. for anything below this node
+    uint mask;
+    vec3 hi;
+    uint parent;
+    // Child nodes, for leaves left is the blob index
+    uint left;
+    uint right;
+    // Refit: the second child to arrive computes the bounds
+    uint visits;
+    uint pad;
+};
+
+// Float bits which keep their order when compared as uints, for atomicMin/Max
+uint order_float(float f) {
+    uint u = floatBitsToUint(f);
+    return (u & 0x80000000u) != 0 ? ~u : u | 0x80000000u;
+}
+
+float unorder_float(uint u) {
+    return uintBitsToFloat((u & 0x80000000u) != 0 ? u & 0x7fffffffu : ~u);
+}
+
+// What a leaf of the blob contributes to the node masks
+uint blob_bvh_mask(in blob b, bool is_add) {
+    uint mask = is_add ? bvh_static_add : bvh_static_sub;
+    return (b.flags & blob_flag_dynamic) != 0 ? mask << 2 : mask;
+}
+
+// Bounds of the blob itself, without the smoothing margin (get_blob_bounds in blob.cpp)
+void blob_bounds(in blob b, out vec3 lo, out vec3 hi) {
+    vec3 extent;
+
+    switch (b.type) {
+    case sdf_sphere: extent = vec3(b.scale.w); break;
+    case sdf_cube: {
+        vec4 q = b.rotation;
+        // Columns of the rotation matrix
+        vec3 x = vec3(1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y));
+        vec3 y = vec3(2.0 * (q.x * q.y - q.w * q.z), 1.0 - 2.0 * (q.x * q.x + q.z * q.z), 2.0 * (q.y * q.z + q.w * q.x));
+        vec3 z = vec3(2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y));
+        extent = abs(x) * b.scale.x + abs(y) * b.scale.y + abs(z) * b.scale.z + vec3(b.scale.w);
+    } break;
+    default: extent = vec3(0.0); break;
+    }
+
+    lo = b.position.xyz - extent;
+    hi = b.position.xyz + extent;
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef MARCH_COST_GLSL
+#define MARCH_COST_GLSL
+
+#ifdef MIRAGE_INSTRUMENT
+
+// Instrumentation for the blob_cast_instrumented variant
+// x = march steps, y = shadow steps, z = map() calls, w = 1 if the ray hit
+
+layout (set = 12, binding = 0, rgba32ui) uniform writeonly uimage2D ucost_image;
+
+layout (set = 13, binding = 0) buffer cost_counters {
+    uint march_steps;
+    uint shadow_steps;
+    uint map_calls;
+    uint hit_pixels;
+} ucounters;
+
+uvec4 g_cost = uvec4(0);
+
+shared uint s_group_cost[4];
+
+#define COUNT_MARCH_STEP() (++g_cost.x)
+#define COUNT_SHADOW_STEP() (++g_cost.y)
+#define COUNT_MAP_CALL() (++g_cost.z)
+#define COUNT_HIT() (g_cost.w = 1)
+
+void begin_cost_counters() {
+    if (gl_LocalInvocationIndex == 0) {
+        s_group_cost[0] = 0;
+        s_group_cost[1] = 0;
+        s_group_cost[2] = 0;
+        s_group_cost[3] = 0;
+    }
+
+    barrier();
+}
+
+void store_pixel_cost(ivec2 pixel_coords) {
+    imageStore(ucost_image, pixel_coords, g_cost);
+}
+
+// Reduce in shared memory first so that there is one global atomic per counter per workgroup
+void end_cost_counters() {
+    atomicAdd(s_group_cost[0], g_cost.x);
+    atomicAdd(s_group_cost[1], g_cost.y);
+    atomicAdd(s_group_cost[2], g_cost.z);
+    atomicAdd(s_group_cost[3], g_cost.w);
+
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0) {
+        atomicAdd(ucounters.march_steps, s_group_cost[0]);
+        atomicAdd(ucounters.shadow_steps, s_group_cost[1]);
+        atomicAdd(ucounters.map_calls, s_group_cost[2]);
+        atomicAdd(ucounters.hit_pixels, s_group_cost[3]);
+    }
+}
+
+#else
+
+#define COUNT_MARCH_STEP()
+#define COUNT_SHADOW_STEP()
+#define COUNT_MAP_CALL()
+#define COUNT_HIT()
+
+#endif
+
+#endif
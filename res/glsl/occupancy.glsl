@@ -0,0 +1,30 @@
+#ifndef OCCUPANCY_GLSL
+#define OCCUPANCY_GLSL
+
+#include "distance_pyramid.glsl"
+
+/* One bit per cell over the region of the distance pyramid (occupancy_pass.cpp),
+ * set when the static surface may pass through the cell. Bits run along x
+ * first, so a word covers 32 cells of a row. */
+
+#define occupancy_size 128
+#define occupancy_word_count (occupancy_size * occupancy_size * occupancy_size / 32)
+
+// Along each axis
+#define occupancy_cells_per_pyramid_cell (occupancy_size / pyramid_size)
+
+#define occupancy_lo pyramid_lo
+#define occupancy_cell_size (pyramid_cell_size / float(occupancy_cells_per_pyramid_cell))
+
+// Cells a single skip walks at most before giving the field a look again
+#define occupancy_max_cells 32
+
+uint occupancy_cell_index(ivec3 cell) {
+    return uint(cell.x + (cell.y + cell.z * occupancy_size) * occupancy_size);
+}
+
+bool is_in_occupancy_grid(ivec3 cell) {
+    return all(greaterThanEqual(cell, ivec3(0))) && all(lessThan(cell, ivec3(occupancy_size)));
+}
+
+#endif
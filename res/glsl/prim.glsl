@@ -0,0 +1,105 @@
+#ifndef PRIM_GLSL
+#define PRIM_GLSL
+
+/* Shared pieces of the compute primitives (gpu_primitives.cpp). Every
+ * primitive runs 256 threads per workgroup.
+ *
+ * Single pass primitives use decoupled lookback (Merrill & Garland,
+ * Single-pass Parallel Prefix Scan with Decoupled Look-back): tiles take an
+ * id from a counter in the order they start, publish their own aggregate
+ * right away and then walk back over their predecessors until they find one
+ * with an inclusive prefix. Status words pack a 2 bit flag with a 30 bit
+ * value, so sums have to stay below 2^30. */
+
+#define prim_group_size 256
+
+#define prim_flag_invalid 0u
+#define prim_flag_aggregate 1u
+#define prim_flag_prefix 2u
+#define prim_value_mask 0x3fffffffu
+
+#ifdef PRIM_STATUS_SET
+// Cleared to zero before every use
+layout (set = PRIM_STATUS_SET, binding = 0) coherent volatile buffer prim_status {
+    uint tile_counter;
+    uint pad0;
+    uint pad1;
+    uint pad2;
+
+    uint status[];
+} ustatus;
+
+shared uint s_prim_tile;
+
+// Tile ids in the order workgroups start, so every tile only waits on ones which are running
+uint acquire_tile() {
+    if (gl_LocalInvocationIndex == 0) {
+        s_prim_tile = atomicAdd(ustatus.tile_counter, 1);
+    }
+
+    barrier();
+    return s_prim_tile;
+}
+
+void publish_status(uint idx, uint flag, uint value) {
+    atomicExchange(ustatus.status[idx], (flag << 30) | (value & prim_value_mask));
+}
+
+// Exclusive prefix for status word tile * stride + lane, spins on tiles which haven't published
+uint look_back(uint tile, uint stride, uint lane, uint aggregate) {
+    if (tile == 0) {
+        publish_status(lane, prim_flag_prefix, aggregate);
+        return 0;
+    }
+
+    publish_status(tile * stride + lane, prim_flag_aggregate, aggregate);
+
+    uint prefix = 0;
+    uint predecessor = tile - 1;
+
+    for (;;) {
+        uint status = ustatus.status[predecessor * stride + lane];
+        uint flag = status >> 30;
+
+        if (flag == prim_flag_invalid) {
+            continue;
+        }
+
+        prefix += status & prim_value_mask;
+
+        if (flag == prim_flag_prefix) {
+            break;
+        }
+
+        --predecessor;
+    }
+
+    publish_status(tile * stride + lane, prim_flag_prefix, prefix + aggregate);
+    return prefix;
+}
+#endif
+
+shared uint s_prim_scan[prim_group_size];
+
+// Exclusive scan over the workgroup (Hillis-Steele), every thread has to call it
+uint workgroup_exclusive_scan(uint value, out uint total) {
+    uint local_idx = gl_LocalInvocationIndex;
+
+    s_prim_scan[local_idx] = value;
+    barrier();
+
+    for (uint offset = 1; offset < prim_group_size; offset <<= 1) {
+        uint add = local_idx >= offset ? s_prim_scan[local_idx - offset] : 0;
+        barrier();
+        s_prim_scan[local_idx] += add;
+        barrier();
+    }
+
+    uint inclusive = s_prim_scan[local_idx];
+    total = s_prim_scan[prim_group_size - 1];
+    barrier();
+
+    return inclusive - value;
+}
+
+#endif
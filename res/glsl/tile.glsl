@@ -0,0 +1,32 @@
+#ifndef TILE_GLSL
+#define TILE_GLSL
+
+// Screen tiles of blob_cast (final_pass.cpp)
+
+#include "tile_layout.h"
+
+/* Two VkDispatchIndirectCommands followed by the tile list. tile_classify
+ * appends the tiles which can hit a blob from the front (counted in the
+ * first command) and the empty ones from the back (counted in the second),
+ * so each command's x is the group count of the pass reading those tiles. */
+struct tile_dispatch {
+    uint x;
+    uint y;
+    uint z;
+    uint pad;
+};
+
+// Tile coordinates are packed as x | y << 16
+uint pack_tile(uvec2 tile) {
+    return tile.x | (tile.y << 16);
+}
+
+uvec2 unpack_tile(uint tile) {
+    return uvec2(tile & 0xffffu, tile >> 16);
+}
+
+uvec2 tile_count(ivec2 extent) {
+    return uvec2((extent + tile_size - 1) / tile_size);
+}
+
+#endif
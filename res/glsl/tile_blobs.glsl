@@ -0,0 +1,40 @@
+#ifndef TILE_BLOBS_GLSL
+#define TILE_BLOBS_GLSL
+
+#include "tile.glsl"
+
+/* Blobs which can matter to the rays of a tile, written by tile_classify
+ * for every hit tile (indexed by its position, not its slot in the tile
+ * list). A tile whose list doesn't fit gets split into 8x8 quadrants, and
+ * a quadrant which still doesn't fit into 4x4 cells. The lists of a tile
+ * share its pool, each cell says which one its pixels use. A cell without
+ * one falls back to the BVH. The sizes are in tile_layout.h. */
+
+// Set on the pool entries of additions, the rest are subtractions
+#define tile_blob_add_bit 0x80000000u
+
+struct tile_blobs {
+    // Per cell: first pool entry of its list, entry count << 8 and addition count << 16
+    uint cells[tile_cell_count];
+    uint pool_count;
+    uint pad0;
+    uint pad1;
+    uint pad2;
+    // Blob indices, each list has its additions first
+    uint pool[tile_blob_pool_size];
+};
+
+uint pack_tile_cell(uint first, uint count, uint add_count) {
+    return first | (count << 8) | (add_count << 16);
+}
+
+uint tile_list_first(uint cell) { return cell & 0xffu; }
+uint tile_list_count(uint cell) { return (cell >> 8) & 0xffu; }
+uint tile_list_add_count(uint cell) { return (cell >> 16) & 0xffu; }
+
+// Cell of a pixel given its position inside the tile
+uint tile_cell(uvec2 local) {
+    return local.x / tile_cell_size + tile_cells_per_side * (local.y / tile_cell_size);
+}
+
+#endif
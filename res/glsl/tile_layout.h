@@ -0,0 +1,22 @@
+#ifndef TILE_LAYOUT_H
+#define TILE_LAYOUT_H
+
+/* Layout of the screen tiles and their blob lists, only plain defines so
+ * that the shaders (tile.glsl, tile_blobs.glsl) and final_pass.cpp read
+ * the same numbers */
+
+#define tile_size 16
+
+// Pixels per side of the smallest region of a tile with a list of its own
+#define tile_cell_size 4
+#define tile_cells_per_side (tile_size / tile_cell_size)
+#define tile_cell_count (tile_cells_per_side * tile_cells_per_side)
+
+// Per list, blob_cast keeps a bit per entry
+#define tile_blob_capacity 32
+#define tile_blob_pool_size (4 * tile_blob_capacity)
+
+// Cell whose list didn't fit
+#define tile_blobs_unpruned 0xffffffffu
+
+#endif
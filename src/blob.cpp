@@ -1,84 +1,944 @@
+#include "sim.hpp"
 #include "blob.hpp"
-#include "time.hpp"
+#include "scene.hpp"
+#include "jobs.hpp"
 #include "buffer.hpp"
+#include "journal.hpp"
 #include "memory.hpp"
 #include "core_render.hpp"
+#include "scene_shader.hpp"
+#include "render_context.hpp"
+
+#include <float.h>
+#include <algorithm>
 
 /* Divide the space into voxels (maybe in frustum space),
  * Each voxel/froxel stores an array of the blobs which
  * affect that space. */
 
-static constexpr u32 max_blob_data_size_() {
-    return sizeof(u32) + 2 * max_blob_count * sizeof(blob);
+// Room for blobs added at runtime, the buffers are sized once when the scene gets loaded
+static constexpr u32 blob_headroom_ = 1024;
+static constexpr u32 no_free_slot_ = 0xffffffff;
+
+static std::string scene_path_;
+// hash_scene of what got loaded, the journal has to be for exactly that
+static u64 scene_hash_;
+
+// The blobs the built in scene animates
+static blob_handle animated_blobs_[2];
+
+// Byte offset of a blob in blob_data (of the end of the buffer for idx == capacity)
+static u32 blob_data_offset_(u32 idx) {
+    return sizeof(blob_list_header) + idx * sizeof(blob);
 }
 
-static void add_blob_(const blob &b) {
-    switch (b.op) {
-    case sdf_smooth_add: {
-        ggfx->blobs->add_data[ggfx->blobs->add_count++] = b;
-    } break;
+// Regions touched since the last snapshot
+static small_vector<aabb, 16> pending_invalidated_;
 
-    case sdf_smooth_sub: {
-        ggfx->blobs->sub_data[ggfx->blobs->sub_count++] = b;
-    } break;
+// The counts the last scene shader version was made for
+static blob_list_header shader_header_;
+
+// The counts of the last snapshot, and whether a snapshot nobody picked up changed static blobs
+static blob_list_header snapshot_header_;
+static bool is_static_changed_ = true;
+static aabb static_bounds_;
 
-    default: assert(false);
+// Render side: the snapshot being uploaded and how many of its blobs already are
+static blob_snapshot *uploading_;
+static u32 uploaded_;
+static bool is_csg_uploaded_;
+// The counts go last, until then the GPU keeps drawing the previous snapshot's
+static bool is_header_uploaded_;
+
+template <typename T>
+static T *allocate_component_(u32 capacity) {
+    return (T *)mem_alloc_raw(sizeof(T) * capacity, alignof(T));
+}
+
+static void allocate_blobs_(u32 capacity) {
+    blob_store *store = ggfx->blobs;
+    store->capacity = capacity;
+
+    store->positions = allocate_component_<v3>(capacity);
+    store->scales = allocate_component_<v4>(capacity);
+    store->rotations = allocate_component_<q4>(capacity);
+    store->types = allocate_component_<u32>(capacity);
+    store->ops = allocate_component_<u32>(capacity);
+    store->materials = allocate_component_<u32>(capacity);
+    store->flags = allocate_component_<u32>(capacity);
+    store->dense_to_slot = allocate_component_<u32>(capacity);
+
+    // Slots are handed out in order, so a freshly loaded scene has slot == dense index
+    store->slots = allocate_component_<blob_slot>(capacity);
+    for (u32 i = 0; i < capacity; ++i) {
+        store->slots[i].dense = i + 1 < capacity ? i + 1 : no_free_slot_;
+        store->slots[i].generation = 0;
+        store->slots[i].next_generation = 1;
     }
+    store->free_slot = capacity ? 0 : no_free_slot_;
+
+    u32 mask_size = sizeof(u64) * ((capacity + 63) / 64);
+    store->dirty_mask = (u64 *)mem_alloc_raw(mask_size, alignof(u64));
+    zero_memory(store->dirty_mask, mask_size);
+
+    ggfx->blob_data = make_storage_buffer(blob_data_offset_(capacity));
 }
 
-static blob *get_blob_(op_type type, u32 idx) {
+static void mark_dirty_(u32 idx) {
+    blob_store *store = ggfx->blobs;
+    u64 bit = 1ull << (idx % 64);
+
+    if (!(store->dirty_mask[idx / 64] & bit)) {
+        store->dirty_mask[idx / 64] |= bit;
+        store->dirty.push_back(idx);
+    }
+}
+
+// Bounding sphere of the surface, blob_map.glsl adds the smoothing
+static f32 bounding_radius_(u32 type, const v4 &scale) {
     switch (type) {
-    case sdf_smooth_add: {
-        return &ggfx->blobs->add_data[idx];
+    case sdf_sphere: return scale.w;
+    case sdf_cube: return glm::length(v3(scale)) + scale.w;
+    default: return 0.0f;
+    }
+}
+
+static blob pack_blob_(u32 idx) {
+    const blob_store *store = ggfx->blobs;
+    const q4 &rotation = store->rotations[idx];
+
+    blob b = {};
+    b.position = v4(store->positions[idx], bounding_radius_(store->types[idx], store->scales[idx]));
+    b.scale = store->scales[idx];
+    b.rotation = v4(rotation.x, rotation.y, rotation.z, rotation.w);
+    b.type = store->types[idx];
+    b.op = store->ops[idx];
+    b.material = store->materials[idx];
+    b.flags = store->flags[idx];
+
+    return b;
+}
+
+// Whole scene in the GPU layout, free with mem_freev
+static blob *pack_blobs_() {
+    u32 count = ggfx->blobs->header.count;
+
+    blob *packed = mem_allocv<blob>(count);
+    parallel_for(count, [packed] (u32 begin, u32 end) {
+        for (u32 i = begin; i < end; ++i) {
+            packed[i] = pack_blob_(i);
+        }
+    });
+
+    return packed;
+}
+
+// CSG tree with the leaves as dense indices like in scene files, nullptr
+// without one, free with mem_freev
+static csg_node *pack_csg_() {
+    const small_vector<csg_node, 16> &csg = ggfx->blobs->csg;
+    if (csg.empty()) {
+        return nullptr;
+    }
+
+    csg_node *packed = mem_allocv<csg_node>(csg.size());
+    for (u32 i = 0; i < csg.size(); ++i) {
+        packed[i] = csg[i];
+
+        if (csg[i].op == csg_op_leaf) {
+            blob_handle handle = { csg[i].left, csg[i].right };
+            packed[i].left = csg[i].left != csg_no_blob && is_blob_alive(handle) ? get_blob_index(handle) : csg_no_blob;
+            packed[i].right = 0;
+        }
+    }
+
+    return packed;
+}
+
+static void unpack_blob_(u32 idx, const blob &b) {
+    blob_store *store = ggfx->blobs;
+
+    store->positions[idx] = v3(b.position);
+    store->scales[idx] = b.scale;
+    store->rotations[idx] = q4(b.rotation.w, b.rotation.x, b.rotation.y, b.rotation.z);
+    store->types[idx] = b.type;
+    store->ops[idx] = b.op;
+    store->materials[idx] = b.material;
+    store->flags[idx] = b.flags;
+}
+
+static void set_blob_(u32 idx, const blob &b, u32 slot) {
+    blob_store *store = ggfx->blobs;
+
+    unpack_blob_(idx, b);
+    store->dense_to_slot[idx] = slot;
+    store->slots[slot].dense = idx;
+
+    mark_dirty_(idx);
+}
+
+static void move_dense_(u32 dst, u32 src) {
+    if (dst == src) {
+        return;
+    }
+
+    blob_store *store = ggfx->blobs;
+    u32 slot = store->dense_to_slot[src];
+
+    store->positions[dst] = store->positions[src];
+    store->scales[dst] = store->scales[src];
+    store->rotations[dst] = store->rotations[src];
+    store->types[dst] = store->types[src];
+    store->ops[dst] = store->ops[src];
+    store->materials[dst] = store->materials[src];
+    store->flags[dst] = store->flags[src];
+    store->dense_to_slot[dst] = slot;
+    store->slots[slot].dense = dst;
+
+    mark_dirty_(dst);
+}
+
+static blob_handle allocate_slot_() {
+    blob_store *store = ggfx->blobs;
+
+    u32 slot = store->free_slot;
+    store->free_slot = store->slots[slot].dense;
+    store->slots[slot].generation = store->slots[slot].next_generation++;
+
+    return { slot, store->slots[slot].generation };
+}
+
+static void free_slot_(u32 slot) {
+    blob_store *store = ggfx->blobs;
+
+    // Outstanding handles go stale
+    store->slots[slot].generation = 0;
+    store->slots[slot].dense = store->free_slot;
+    store->free_slot = slot;
+}
+
+// Undo runs in reverse order, so the slot is normally the head of the free list
+static void reclaim_slot_(blob_handle handle) {
+    blob_store *store = ggfx->blobs;
+
+    u32 *link = &store->free_slot;
+    while (*link != handle.slot) {
+        assert(*link != no_free_slot_);
+        link = &store->slots[*link].dense;
+    }
+
+    *link = store->slots[handle.slot].dense;
+    store->slots[handle.slot].generation = handle.generation;
+}
+
+aabb get_blob_bounds(const blob &b) {
+    v3 extent;
+
+    switch (b.type) {
+    case sdf_sphere: extent = v3(b.scale.w); break;
+    case sdf_cube: {
+        // Extent of the rotated box along each world axis
+        glm::mat3 rotation = glm::mat3_cast(q4(b.rotation.w, b.rotation.x, b.rotation.y, b.rotation.z));
+        v3 half = v3(b.scale);
+        extent = v3(
+            glm::abs(rotation[0][0]) * half.x + glm::abs(rotation[1][0]) * half.y + glm::abs(rotation[2][0]) * half.z,
+            glm::abs(rotation[0][1]) * half.x + glm::abs(rotation[1][1]) * half.y + glm::abs(rotation[2][1]) * half.z,
+            glm::abs(rotation[0][2]) * half.x + glm::abs(rotation[1][2]) * half.y + glm::abs(rotation[2][2]) * half.z);
+        extent += v3(b.scale.w);
     } break;
+    default: extent = v3(0.0f); break;
+    }
 
-    case sdf_smooth_sub: {
-        return &ggfx->blobs->sub_data[idx];
+    extent += v3(blob_smoothing);
+    return { v3(b.position) - extent, v3(b.position) + extent };
+}
+
+// Only the static blobs get baked into anything, see blob_flag_dynamic
+static void invalidate_(const blob &b) {
+    if (!(b.flags & blob_flag_dynamic)) {
+        pending_invalidated_.push_back(get_blob_bounds(b));
+    }
+}
+
+static bool is_addition_(const blob &b) {
+    return b.op == sdf_smooth_add;
+}
+
+/* A blob added to a scene with a CSG tree gets blended into the whole tree
+ * by its op, the way the fixed pattern would combine it. Its leaf stays when
+ * it gets deleted (gone blobs fold away), so undoing the delete brings it
+ * back with the same handle. */
+static void link_csg_leaf_(const blob &b, blob_handle handle) {
+    blob_store *store = ggfx->blobs;
+    if (store->csg.empty()) {
+        return;
+    }
+
+    u32 root = store->csg.size() - 1;
+    store->csg.push_back({ csg_op_leaf, 0.0f, handle.slot, handle.generation });
+    store->csg.push_back({ is_addition_(b) ? (u32)sdf_smooth_add : (u32)sdf_smooth_sub, blob_smoothing, root, root + 1 });
+    store->is_csg_changed = true;
+}
+
+/* Additions stay in front of the subtractions. Removing one fills the hole
+ * with the last blob of its partition (and for additions, the partition
+ * boundary with the last subtraction), restoring does the exact opposite.
+ * Every edit touches a constant number of blobs. */
+static void apply_edit_(const blob_edit &edit) {
+    blob_store *store = ggfx->blobs;
+    u32 &add_count = store->header.add_count;
+    u32 &count = store->header.count;
+
+    switch (edit.op) {
+    case blob_edit_add: {
+        blob_handle handle = allocate_slot_();
+        if (!(handle == edit.handle)) {
+            log_warning("Replayed blob got handle %u:%u instead of %u:%u",
+                handle.slot, handle.generation, edit.handle.slot, edit.handle.generation);
+        }
+
+        if (is_addition_(edit.after)) {
+            if (add_count != count) {
+                move_dense_(count, add_count);
+            }
+
+            set_blob_(add_count++, edit.after, handle.slot);
+        }
+        else {
+            set_blob_(count, edit.after, handle.slot);
+        }
+
+        ++count;
+        invalidate_(edit.after);
+        link_csg_leaf_(edit.after, handle);
+    } break;
+
+    case blob_edit_delete: {
+        free_slot_(edit.handle.slot);
+
+        if (edit.index < add_count) {
+            move_dense_(edit.index, add_count - 1);
+            if (add_count != count) {
+                move_dense_(add_count - 1, count - 1);
+            }
+
+            --add_count;
+        }
+        else {
+            move_dense_(edit.index, count - 1);
+        }
+
+        --count;
+        invalidate_(edit.before);
+    } break;
+
+    case blob_edit_restore: {
+        reclaim_slot_(edit.handle);
+
+        if (is_addition_(edit.after)) {
+            if (add_count != count) {
+                move_dense_(count, add_count);
+            }
+
+            move_dense_(add_count++, edit.index);
+        }
+        else {
+            move_dense_(count, edit.index);
+        }
+
+        ++count;
+        set_blob_(edit.index, edit.after, edit.handle.slot);
+        invalidate_(edit.after);
     } break;
 
-    default: assert(false);
+    case blob_edit_move: {
+        set_blob_(edit.index, edit.after, edit.handle.slot);
+        invalidate_(edit.before);
+        invalidate_(edit.after);
+    } break;
+    }
+}
+
+static blob_edit invert_edit_(const blob_edit &edit) {
+    blob_edit inverse = edit;
+    inverse.is_undo = true;
+    inverse.before = edit.after;
+    inverse.after = edit.before;
+
+    switch (edit.op) {
+    case blob_edit_add: inverse.op = blob_edit_delete; break;
+    case blob_edit_delete: inverse.op = blob_edit_restore; break;
+    case blob_edit_restore: inverse.op = blob_edit_delete; break;
+    case blob_edit_move: inverse.op = blob_edit_move; break;
+    }
+
+    // Deleting clears the generation, restoring hands the old handle back
+    if (inverse.op == blob_edit_delete) {
+        inverse.index = get_blob_index(edit.handle);
+    }
+
+    return inverse;
+}
+
+// Also what replaying the journal does, minus the appending
+static void track_undo_(const blob_edit &edit) {
+    small_vector<blob_edit, 16> &undo_stack = ggfx->blobs->undo_stack;
+
+    if (!edit.is_undo) {
+        undo_stack.push_back(edit);
+    }
+    else if (!undo_stack.empty()) {
+        undo_stack.pop_back();
+    }
+}
+
+static void commit_edit_(const blob_edit &edit) {
+    apply_edit_(edit);
+    append_journal(edit);
+    track_undo_(edit);
+}
+
+bool is_blob_alive(blob_handle handle) {
+    const blob_store *store = ggfx->blobs;
+    return handle.slot < store->capacity && handle.generation &&
+        store->slots[handle.slot].generation == handle.generation;
+}
+
+blob_handle get_blob_handle(u32 dense_idx) {
+    const blob_store *store = ggfx->blobs;
+    u32 slot = store->dense_to_slot[dense_idx];
+    return { slot, store->slots[slot].generation };
+}
+
+u32 get_blob_index(blob_handle handle) {
+    assert(is_blob_alive(handle));
+    return ggfx->blobs->slots[handle.slot].dense;
+}
+
+blob get_blob(blob_handle handle) {
+    return pack_blob_(get_blob_index(handle));
+}
+
+blob_handle add_blob(const blob &b) {
+    blob_store *store = ggfx->blobs;
+
+    if (store->header.count == store->capacity) {
+        log_warning("Blob capacity (%u) reached, save and reload the scene to grow it", store->capacity);
+        return invalid_blob_handle;
+    }
+
+    blob_edit edit = {};
+    edit.op = blob_edit_add;
+    edit.index = is_addition_(b) ? store->header.add_count : store->header.count;
+    edit.handle = { store->free_slot, store->slots[store->free_slot].next_generation };
+    edit.after = b;
+
+    commit_edit_(edit);
+    return edit.handle;
+}
+
+void move_blob(blob_handle handle, const v3 &position) {
+    if (!is_blob_alive(handle)) {
+        return;
     }
+
+    blob_edit edit = {};
+    edit.op = blob_edit_move;
+    edit.index = get_blob_index(handle);
+    edit.handle = handle;
+    edit.before = pack_blob_(edit.index);
+    edit.after = edit.before;
+    edit.after.position = v4(position, edit.before.position.w);
+
+    commit_edit_(edit);
 }
 
-void init_blobs() {
-    ggfx->blob_data = make_uniform_buffer(max_blob_data_size_());
-    ggfx->blobs = mem_alloc<blob_array>();
+void delete_blob(blob_handle handle) {
+    if (!is_blob_alive(handle)) {
+        return;
+    }
+
+    blob_edit edit = {};
+    edit.op = blob_edit_delete;
+    edit.index = get_blob_index(handle);
+    edit.handle = handle;
+    edit.before = pack_blob_(edit.index);
+
+    commit_edit_(edit);
+}
+
+void delete_last_blob() {
+    u32 count = ggfx->blobs->header.count;
+    if (count) {
+        delete_blob(get_blob_handle(count - 1));
+    }
+}
+
+bool undo_blob_edit() {
+    small_vector<blob_edit, 16> &undo_stack = ggfx->blobs->undo_stack;
+    if (undo_stack.empty()) {
+        return false;
+    }
+
+    blob_edit inverse = invert_edit_(undo_stack.back());
+    commit_edit_(inverse);
+
+    return true;
+}
+
+// Blobs of the built in scene are its base state, they don't get journaled
+static blob_handle add_base_blob_(const blob &b) {
+    blob_store *store = ggfx->blobs;
+
+    blob_edit edit = {};
+    edit.op = blob_edit_add;
+    edit.handle = { store->free_slot, store->slots[store->free_slot].next_generation };
+    edit.after = b;
+
+    apply_edit_(edit);
+    return edit.handle;
+}
+
+static void init_default_blobs_() {
+    allocate_blobs_(blob_headroom_);
+    ggfx->blobs->is_animated = true;
+
+    const v4 no_rotation = v4(0.0, 0.0, 0.0, 1.0);
 
     // Hardcode the blobs
-    add_blob_({
-        v4(-1.0, 0.0, 1.0, 1.0), v4(0.6, 0.2, 0.7, 0.55),
-        sdf_sphere, sdf_smooth_add
+    animated_blobs_[0] = add_base_blob_({
+        v4(-1.0, 0.0, 1.0, 1.0), v4(0.6, 0.2, 0.7, 0.55), no_rotation,
+        sdf_sphere, sdf_smooth_add, 0, blob_flag_dynamic
     });
 
-    add_blob_({
-        v4(-1.0, 0.0, 1.0, 1.0), v4(0.6, 0.2, 0.7, 0.1),
+    add_base_blob_({
+        v4(-1.0, 0.0, 1.0, 1.0), v4(0.6, 0.2, 0.7, 0.1), no_rotation,
         sdf_cube, sdf_smooth_add
     });
 
-    add_blob_({
-        v4(1.0, 0.0, 1.0, 1.0), v4(0.6, 0.2, 0.7, 0.55),
-        sdf_sphere, sdf_smooth_add
+    animated_blobs_[1] = add_base_blob_({
+        v4(1.0, 0.0, 1.0, 1.0), v4(0.6, 0.2, 0.7, 0.55), no_rotation,
+        sdf_sphere, sdf_smooth_add, 0, blob_flag_dynamic
     });
 
-    add_blob_({
-        v4(1.0, 0.0, 1.0, 1.0), v4(0.6, 0.2, 0.7, 0.1),
+    add_base_blob_({
+        v4(1.0, 0.0, 1.0, 1.0), v4(0.6, 0.2, 0.7, 0.1), no_rotation,
         sdf_cube, sdf_smooth_add
     });
 }
 
-void update_blobs(render_graph &graph) {
-    // Some objects are moving - offset by a sine wave
-    float sn = glm::sin(gtime->current_time);
-    float cn = glm::cos(gtime->current_time);
+static bool init_scene_blobs_(const char *path) {
+    scene s;
+    if (!open_scene(path, &s)) {
+        return false;
+    }
+
+    u32 count = s.header->blob_count;
+    allocate_blobs_(count + count / 4 + blob_headroom_);
+
+    blob_store *store = ggfx->blobs;
+    store->header.count = count;
+    store->header.add_count = s.header->add_count;
+
+    // Scene blobs take the first slots in order
+    const blob *scene_blobs = s.blobs.data;
+    parallel_for(count, [store, scene_blobs] (u32 begin, u32 end) {
+        for (u32 i = begin; i < end; ++i) {
+            unpack_blob_(i, scene_blobs[i]);
+            store->dense_to_slot[i] = i;
+            store->slots[i].dense = i;
+            store->slots[i].generation = store->slots[i].next_generation++;
+        }
+    });
+    store->free_slot = count < store->capacity ? count : no_free_slot_;
+
+    // Leaves go from dense indices to handles, which survive the edits
+    for (u32 i = 0; i < s.csg_nodes.size; ++i) {
+        const csg_node &node = s.csg_nodes[i];
+        csg_node &loaded = store->csg.emplace_back(node);
+
+        if (node.op == csg_op_leaf && node.left != csg_no_blob) {
+            blob_handle handle = get_blob_handle(node.left);
+            loaded.left = handle.slot;
+            loaded.right = handle.generation;
+        }
+    }
+    store->is_csg_changed = !store->csg.empty();
+
+    scene_hash_ = hash_scene(s.blobs.data, count, s.header->add_count, s.csg_nodes.data, s.csg_nodes.size);
+
+    // The blob section already is in the GPU layout, the mapping gets streamed through the staging ring as is
+    upload_buffer_blocking(ggfx->blob_data, 0, &store->header, sizeof(blob_list_header));
+    upload_buffer_blocking(ggfx->blob_data, sizeof(blob_list_header), s.blobs.data, count * sizeof(blob));
+
+    log_info("Loaded %u blobs and %u CSG nodes from %s", count, store->csg.size(), path);
+    return true;
+}
+
+/* Handles in the journal are from the slot map of the session which wrote
+ * it. Loading a scene numbers the slots anew, so they mean nothing for the
+ * records a compaction carried over. Replay goes by dense index instead and
+ * swaps in the live handle, which is also what ends up on the undo stack.
+ * Undo records have to hit the blob of the edit they revert, unless that
+ * edit is part of the scene file already. False when the record doesn't fit
+ * the scene. */
+static bool resolve_replayed_edit_(blob_edit &edit) {
+    blob_store *store = ggfx->blobs;
+    const small_vector<blob_edit, 16> &undo_stack = store->undo_stack;
+    u32 count = store->header.count;
+    u32 add_count = store->header.add_count;
+
+    switch (edit.op) {
+    case blob_edit_add:
+        if (count == store->capacity) {
+            return false;
+        }
+
+        edit.handle = { store->free_slot, store->slots[store->free_slot].next_generation };
+        return true;
+
+    case blob_edit_delete:
+    case blob_edit_move: {
+        if (edit.index >= count) {
+            return false;
+        }
+
+        u32 slot = store->dense_to_slot[edit.index];
+        blob_handle handle = { slot, store->slots[slot].generation };
+        if (!handle.generation || (edit.is_undo && !undo_stack.empty() && !(undo_stack.back().handle == handle))) {
+            return false;
+        }
+
+        edit.handle = handle;
+        return true;
+    }
+
+    case blob_edit_restore: {
+        // Back into its own partition
+        bool is_in_partition = is_addition_(edit.after) ? edit.index <= add_count : edit.index >= add_count && edit.index <= count;
+        if (!edit.is_undo || count == store->capacity || !is_in_partition) {
+            return false;
+        }
+
+        if (undo_stack.empty()) {
+            // Nothing refers to the blob, any free slot does
+            u32 slot = store->free_slot;
+            edit.handle = { slot, store->slots[slot].next_generation++ };
+            return true;
+        }
+
+        // The slot the delete being undone freed
+        blob_handle handle = undo_stack.back().handle;
+        if (handle.slot >= store->capacity || store->slots[handle.slot].generation) {
+            return false;
+        }
+
+        edit.handle = handle;
+        return true;
+    }
+    }
+
+    return false;
+}
+
+void init_blobs(const char *scene_path) {
+    ggfx->blobs = arena_alloc<blob_store>();
+
+    // Without a path, the scene from the last session is picked up if there is one
+    scene_path_ = scene_path ? scene_path : "scene.mscn";
+
+    bool is_loaded = false;
+    if (file_exists(scene_path_)) {
+        is_loaded = init_scene_blobs_(scene_path_.c_str());
+    }
+
+    if (!is_loaded) {
+        if (scene_path) {
+            log_warning("Falling back to the built in scene");
+        }
+
+        init_default_blobs_();
+
+        blob *packed = pack_blobs_();
+        scene_hash_ = hash_scene(packed, ggfx->blobs->header.count, ggfx->blobs->header.add_count, nullptr, 0);
+        mem_freev(packed);
+    }
+
+    blob_store *store = ggfx->blobs;
+
+    /* A program never has more instructions than the tree has nodes, the
+     * nodes runtime adds link in only count while their blob is alive (one
+     * instruction each, the blob operand gets fused). */
+    u32 max_instruction_count = store->csg.size() + store->capacity;
+    ggfx->csg_program = make_storage_buffer(sizeof(csg_program_header) + max_instruction_count * sizeof(csg_instruction));
+    ggfx->is_csg_program_active = false;
+
+    buffer<const blob_edit> edits = open_journal(scene_path_, store->header.count, store->header.add_count, scene_hash_);
+
+    for (u32 i = 0; i < edits.size; ++i) {
+        blob_edit edit = edits[i];
+
+        // Whatever comes after a record which doesn't fit can't be trusted either
+        if (!resolve_replayed_edit_(edit)) {
+            log_error("Journal record %u (op %u, index %u) doesn't fit the scene, dropping the remaining %u records",
+                i, edit.op, edit.index, edits.size - i);
+            cut_journal(i);
+            break;
+        }
+
+        apply_edit_(edit);
+        track_undo_(edit);
+    }
+}
+
+void tick_blobs(f32 time) {
+    blob_store *store = ggfx->blobs;
+
+    if (store->is_animated) {
+        // Some objects are moving - offset by a sine wave
+        float sn = glm::sin(time);
+        float cn = glm::cos(time);
+
+        if (is_blob_alive(animated_blobs_[0])) {
+            u32 sphere1 = get_blob_index(animated_blobs_[0]);
+            invalidate_(pack_blob_(sphere1));
+            store->positions[sphere1].y = 0.5 + 0.3 * sn;
+            invalidate_(pack_blob_(sphere1));
+            mark_dirty_(sphere1);
+        }
+
+        if (is_blob_alive(animated_blobs_[1])) {
+            u32 sphere2 = get_blob_index(animated_blobs_[1]);
+            invalidate_(pack_blob_(sphere2));
+            store->positions[sphere2].x = 1.0 + 0.3 * sn;
+            store->positions[sphere2].z = 1.0 + 0.3 * cn;
+            invalidate_(pack_blob_(sphere2));
+            mark_dirty_(sphere2);
+        }
+    }
+
+    if (update_journal()) {
+        start_journal_compaction(pack_blobs_(), store->header.count, store->header.add_count, pack_csg_(), store->csg.size());
+    }
+}
+
+/* Whether a shader with the blobs inlined (scene_shader.hpp) would be out of
+ * date. The dynamic blobs of the fixed pattern are read from blob_data, a
+ * CSG program inlines all of them though. Runs before the dirty list gets
+ * cleared. */
+static bool is_scene_changed_() {
+    const blob_store *store = ggfx->blobs;
+    if (store->is_csg_changed || store->header.count != shader_header_.count || store->header.add_count != shader_header_.add_count) {
+        shader_header_ = store->header;
+        return true;
+    }
+
+    for (u32 idx : store->dirty) {
+        if (!store->csg.empty() || !(store->flags[idx] & blob_flag_dynamic)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Subtractions can't add surface, the dynamic blobs don't go into any cache
+static aabb get_static_bounds_() {
+    const blob_store *store = ggfx->blobs;
+    aabb bounds = { v3(FLT_MAX), v3(-FLT_MAX) };
+
+    for (u32 i = 0; i < store->header.add_count; ++i) {
+        if (!(store->flags[i] & blob_flag_dynamic)) {
+            aabb blob_bounds = get_blob_bounds(pack_blob_(i));
+            bounds.min = glm::min(bounds.min, blob_bounds.min);
+            bounds.max = glm::max(bounds.max, blob_bounds.max);
+        }
+    }
+
+    return bounds;
+}
+
+/* Packing happens here, on the simulation side, so the render thread only
+ * has to copy. The dirty list gets sorted so uploads can be done in runs. */
+void write_blob_snapshot(blob_snapshot &snapshot) {
+    blob_store *store = ggfx->blobs;
+
+    small_vector<u32, 64> &dirty = store->dirty;
+    std::sort(dirty.begin(), dirty.end());
+
+    snapshot.header = store->header;
+    snapshot.dirty = dirty;
+    snapshot.packed.resize(dirty.size());
+
+    const u32 *dirty_idx = dirty.data();
+    blob *packed = snapshot.packed.data();
+    parallel_for(dirty.size(), [dirty_idx, packed] (u32 begin, u32 end) {
+        for (u32 i = begin; i < end; ++i) {
+            packed[i] = pack_blob_(dirty_idx[i]);
+        }
+    });
+
+    write_scene_map(snapshot, is_scene_changed_());
+
+    // Bounds of moved blobs change what the compiler can prune, and edits move dense indices
+    snapshot.is_csg_program_changed = false;
+    if (!store->csg.empty() && (!dirty.empty() || store->is_csg_changed)) {
+        snapshot.has_csg_program = compile_csg(store->csg.data(), store->csg.size(), snapshot.csg);
+        snapshot.is_csg_program_changed = true;
+        store->is_csg_changed = false;
+
+        // The tree stays, an edit may well bring it back under the limits
+        if (!snapshot.has_csg_program) {
+            log_warning("Falling back to combining the blobs by their ops");
+        }
+    }
+
+    for (u32 idx : dirty) {
+        store->dirty_mask[idx / 64] &= ~(1ull << (idx % 64));
+    }
+    dirty.clear();
+
+    // Only static blobs invalidate anything
+    bool is_count_changed = store->header.count != snapshot_header_.count || store->header.add_count != snapshot_header_.add_count;
+    snapshot.is_static_changed = is_static_changed_ || is_count_changed || !pending_invalidated_.empty();
+    snapshot_header_ = store->header;
+    is_static_changed_ = false;
+
+    if (snapshot.is_static_changed) {
+        static_bounds_ = get_static_bounds_();
+    }
+    snapshot.static_bounds = static_bounds_;
+
+    snapshot.invalidated = std::move(pending_invalidated_);
+    pending_invalidated_.clear();
+
+    const journal_stats &stats = get_journal_stats();
+    snapshot.undo_count = store->undo_stack.size();
+    snapshot.journal_record_count = stats.record_count;
+    snapshot.journal_compaction_count = stats.compaction_count;
+    snapshot.is_journal_compacting = stats.is_compacting;
+}
+
+void fold_blob_snapshot(const blob_snapshot &snapshot) {
+    // Indices past the current count are gone anyway
+    for (u32 idx : snapshot.dirty) {
+        if (idx < ggfx->blobs->header.count) {
+            mark_dirty_(idx);
+        }
+    }
+
+    for (const aabb &bounds : snapshot.invalidated) {
+        pending_invalidated_.push_back(bounds);
+    }
+
+    if (snapshot.is_csg_program_changed) {
+        ggfx->blobs->is_csg_changed = true;
+    }
+
+    if (snapshot.is_static_changed) {
+        is_static_changed_ = true;
+    }
+
+    fold_scene_map(snapshot);
+}
+
+// The instructions go through the staging ring, false if they don't fit this frame
+static bool upload_csg_program_(render_graph &graph, const blob_snapshot &snapshot) {
+    const csg_program &program = snapshot.csg;
+    u32 size = program.code.size() * sizeof(csg_instruction);
+
+    if (size) {
+        staging_region region = staging_alloc(size);
+        if (!region.size) {
+            return false;
+        }
+
+        memcpy(region.data, program.code.data(), size);
+        ggfx->csg_program.upload(graph, sizeof(csg_program_header), region);
+    }
+
+    csg_program_header header = {};
+    header.instruction_count = program.code.size();
+    header.result_register = program.result_register;
+    ggfx->csg_program.update(graph, 0, sizeof(header), &header);
+
+    ggfx->is_csg_program_active = snapshot.has_csg_program;
+    ggfx->csg_lo = program.lo;
+    ggfx->csg_hi = program.hi;
+    return true;
+}
+
+/* Uploads as much of the snapshot as fits in this frame's staging region, one
+ * copy per contiguous run of dirty indices. A new snapshot only gets picked
+ * up once the previous one is completely uploaded, until then the simulation
+ * keeps folding its changes into the ones it publishes. */
+bool update_blobs(render_graph &graph) {
+    if (was_key_pressed(GLFW_KEY_F5)) {
+        blob_command command = {};
+        command.type = blob_command_save;
+        submit_blob_command(command);
+    }
+
+    if (!uploading_ || (is_header_uploaded_ && is_csg_uploaded_)) {
+        blob_snapshot *snapshot = consume_blob_snapshot();
+        if (!snapshot) {
+            return false;
+        }
+
+        uploading_ = snapshot;
+        uploaded_ = 0;
+        is_csg_uploaded_ = !snapshot->is_csg_program_changed;
+        is_header_uploaded_ = false;
+        ggfx->blob_view = snapshot;
+    }
+
+    const small_vector<u32, 64> &dirty = uploading_->dirty;
+    u32 max_run = get_staging_capacity() / sizeof(blob);
+
+    while (uploaded_ < dirty.size()) {
+        u32 first = dirty[uploaded_];
+        u32 count = 1;
+        while (uploaded_ + count < dirty.size() && count < max_run && dirty[uploaded_ + count] == first + count) {
+            ++count;
+        }
+
+        staging_region region = staging_alloc(count * sizeof(blob));
+        if (!region.size) {
+            // The rest goes next frame
+            break;
+        }
+
+        memcpy(region.data, &uploading_->packed[uploaded_], count * sizeof(blob));
+        ggfx->blob_data.upload(graph, blob_data_offset_(first), region);
+
+        uploaded_ += count;
+    }
+
+    if (!is_header_uploaded_ && uploaded_ == dirty.size()) {
+        ggfx->blob_data.update(graph, 0, sizeof(blob_list_header), &uploading_->header);
+        is_header_uploaded_ = true;
+    }
+
+    if (!is_csg_uploaded_) {
+        is_csg_uploaded_ = upload_csg_program_(graph, *uploading_);
+    }
+
+    return true;
+}
+
+void save_blobs() {
+    blob_store *store = ggfx->blobs;
 
-    blob *sphere1 = get_blob_(sdf_smooth_add, 0);
-    blob *sphere2 = get_blob_(sdf_smooth_add, 2);
-    // blob *sphere3 = get_blob_(sdf_smooth_add, 2);
+    blob *packed = pack_blobs_();
+    csg_node *packed_csg = pack_csg_();
+    save_journal_scene(packed, store->header.count, store->header.add_count, packed_csg, store->csg.size());
+    mem_freev(packed);
 
-    sphere1->position.y = 0.5 + 0.3 * sn;
-    // sphere2->position.x = 0.6 + 0.3 * an;
-    sphere2->position.x = 1.0 + 0.3 * sn;
-    sphere2->position.z = 1.0 + 0.3 * cn;
+    if (packed_csg) {
+        mem_freev(packed_csg);
+    }
+}
 
-    ggfx->blob_data.update(graph, 0, max_blob_data_size_(), ggfx->blobs);
+void shutdown_blobs() {
+    close_journal();
 }
@@ -1,9 +1,14 @@
 #pragma once
 
+#include "csg.hpp"
 #include "types.hpp"
 #include "render_graph.hpp"
+#include "small_vector.hpp"
 
-constexpr u32 max_blob_count = 32;
+#include <string>
+
+// Smoothing radius of the blends in blob_cast.comp, a blob affects the field this far past its surface
+constexpr f32 blob_smoothing = 0.25f;
 
 enum blob_type {
     sdf_sphere, sdf_cube
@@ -18,23 +23,189 @@ enum op_type {
     sdf_smooth_intersect
 };
 
+enum blob_flag : u32 {
+    // Moves all the time (animation), evaluated analytically on top of the
+    // baked field of the others (brick_map_pass.cpp) and never invalidates it
+    blob_flag_dynamic = 1 << 0
+};
+
+// Packed form of a blob: same layout as blob in blob.glsl and in scene files
 struct blob {
-    // Add rotations later
+    // w: radius of a sphere around position which bounds the surface, only
+    // for the early outs of blob_map.glsl (filled in when packing)
     v4 position;
+    // xyz: cube half extents, w: sphere radius / cube rounding
     v4 scale;
+    // Quaternion as xyzw
+    v4 rotation;
     u32 type;
     u32 op;
-    u32 pad[2];
+    u32 material;
+    u32 flags;
 };
 
-struct blob_array {
-    u32 sub_count;
+static_assert(sizeof(blob) == 64, "blob has to match the std430 layout");
+
+// Start of the blob storage buffer, the blobs follow right after
+struct blob_list_header {
+    u32 count;
     u32 add_count;
     u32 pad[2];
+};
+
+struct aabb {
+    v3 min;
+    v3 max;
+};
+
+// Region of the field a blob can change, including the smooth blend
+aabb get_blob_bounds(const blob &b);
+
+// Stays valid until the blob gets deleted, generation 0 is never handed out
+struct blob_handle {
+    u32 slot;
+    u32 generation;
+};
+
+inline bool operator==(const blob_handle &a, const blob_handle &b) {
+    return a.slot == b.slot && a.generation == b.generation;
+}
+
+constexpr blob_handle invalid_blob_handle = { 0, 0 };
+
+enum blob_edit_op : u32 {
+    blob_edit_add,
+    blob_edit_delete,
+    blob_edit_move,
+    // Puts a deleted blob back where it was (undoing a delete)
+    blob_edit_restore
+};
+
+/* Journal record (see journal.hpp). Carries both states so that it can be
+ * replayed and undone on its own, undos are journaled as the inverse edit */
+struct blob_edit {
+    u32 op;
+    // Dense index at the time of the edit
+    u32 index;
+    u32 is_undo;
+    u32 pad0;
+    blob_handle handle;
+    u32 pad1[2];
+    blob before;
+    blob after;
+};
+
+static_assert(sizeof(blob_edit) == 160, "blob_edit is part of the journal format");
 
-    blob sub_data[max_blob_count];
-    blob add_data[max_blob_count];
+// Free slots link through dense and have generation 0. Generations only ever
+// count up, so an undo handing an old handle back can't collide with a newer one
+struct blob_slot {
+    u32 dense;
+    u32 generation;
+    u32 next_generation;
 };
 
-void init_blobs();
-void update_blobs(render_graph &graph);
+/* Slot map over SoA component arrays. The component arrays are dense and
+ * keep the GPU order (additions first, then subtractions), removing a blob
+ * swap-removes within its partition. Handles go through the slots, which
+ * never move, so they survive the compaction. Blobs get packed into the
+ * GPU layout when they're uploaded. */
+struct blob_store {
+    blob_list_header header;
+    u32 capacity;
+
+    // Dense components
+    v3 *positions;
+    v4 *scales;
+    q4 *rotations;
+    u32 *types;
+    u32 *ops;
+    u32 *materials;
+    u32 *flags;
+    u32 *dense_to_slot;
+
+    // As many slots as the capacity, live blobs can never need more
+    blob_slot *slots;
+    u32 free_slot;
+
+    // Blobs which changed since the last snapshot, dirty_mask has a bit per dense index
+    small_vector<u32, 64> dirty;
+    u64 *dirty_mask;
+    // Only the built in scene gets animated
+    u32 is_animated : 1;
+    // The CSG program has to be compiled again even if no blob changed
+    u32 is_csg_changed : 1;
+
+    // The scene's CSG tree with the leaves as handles, empty when the blobs combine by their ops
+    small_vector<csg_node, 16> csg;
+
+    // Edits which can still be undone
+    small_vector<blob_edit, 16> undo_stack;
+};
+
+/* What the render thread gets to see of the blob store (see sim.hpp): only
+ * what changed since the previous snapshot, already packed. A snapshot the
+ * render thread never picked up gets folded into the next one. */
+struct blob_snapshot {
+    u64 tick;
+    blob_list_header header;
+
+    // Dense indices (ascending) and the packed blobs to upload there
+    small_vector<u32, 64> dirty;
+    small_vector<blob, 64> packed;
+
+    // Regions touched by edits and the animation, for whatever caches the field (brick_map_pass.cpp)
+    small_vector<aabb, 16> invalidated;
+    // Static blobs changed or blobs came and went since the last snapshot,
+    // rather than only dynamic ones moving (lbvh_pass.cpp rebuilds instead of refitting)
+    bool is_static_changed;
+    // Where the static additions can put surface (min > max if nowhere), for
+    // the caches which are fitted to it (distance_pyramid_pass.cpp)
+    aabb static_bounds;
+
+    // Compiled again whenever blobs changed, the bounds decide what gets pruned
+    csg_program csg;
+    bool has_csg_program;
+    bool is_csg_program_changed;
+
+    // Bumped by every change a specialized blob_cast can't follow (scene_shader.hpp)
+    u64 scene_version;
+    // GLSL of the field for scene_version, only in the snapshot which brings a new one
+    std::string scene_map;
+
+    // For the overlay
+    u32 undo_count;
+    u64 journal_record_count;
+    u64 journal_compaction_count;
+    bool is_journal_compacting;
+    f32 sim_ms;
+};
+
+// Loads the scene file (see scene.hpp) and replays its journal, or the built in scene if there is none
+void init_blobs(const char *scene_path);
+void shutdown_blobs();
+
+// Simulation thread: the blob store and all edits belong to it
+void tick_blobs(f32 time);
+void write_blob_snapshot(blob_snapshot &snapshot);
+// Puts the changes of a snapshot nobody picked up back into the store
+void fold_blob_snapshot(const blob_snapshot &snapshot);
+void save_blobs();
+
+// Render thread: uploads what changed in the newest snapshot, true when blob_data changed
+bool update_blobs(render_graph &graph);
+
+// Simulation thread only from here on (or before start_sim)
+bool is_blob_alive(blob_handle handle);
+blob_handle get_blob_handle(u32 dense_idx);
+// Dense index, only valid until the next edit
+u32 get_blob_index(blob_handle handle);
+blob get_blob(blob_handle handle);
+
+// Edits, all journaled
+blob_handle add_blob(const blob &b);
+void move_blob(blob_handle handle, const v3 &position);
+void delete_blob(blob_handle handle);
+// The blob with the highest dense index
+void delete_last_blob();
+bool undo_blob_edit();
@@ -0,0 +1,231 @@
+#include "log.hpp"
+#include "compute.hpp"
+#include "core_render.hpp"
+#include "memory.hpp"
+
+#include <stddef.h>
+
+/* Sparse brick cache of the blob field (brick.glsl has the layout). Only the
+ * cells overlapping a region the snapshot invalidated get looked at again:
+ *
+ *   brick_classify   per cell of each region: near the surface it queues the
+ *                    cell for baking, otherwise frees its brick and stores
+ *                    a distance bound
+ *   brick_bake       indirect over the queued cells, allocates missing
+ *                    bricks from the pool and samples the blobs into them
+ *
+ * blob_cast then samples the atlas instead of walking the BVH. */
+
+// Same as brick.glsl
+static constexpr u32 grid_size_ = 32;
+static constexpr f32 cell_size_ = 0.25f;
+static constexpr u32 brick_voxels_ = 8;
+static constexpr u32 atlas_bricks_x_ = 32;
+static constexpr u32 atlas_bricks_y_ = 32;
+static constexpr u32 atlas_bricks_z_ = 8;
+static constexpr f32 max_empty_distance_ = 0.5f;
+static constexpr u32 brick_none_ = 0xffffffff;
+static const v3 grid_lo_ = v3(-4.0f, -2.0f, -4.0f);
+
+static constexpr u32 cell_count_ = grid_size_ * grid_size_ * grid_size_;
+static constexpr u32 brick_count_ = atlas_bricks_x_ * atlas_bricks_y_ * atlas_bricks_z_;
+
+// More regions than this get merged into one
+static constexpr u32 max_regions_ = 16;
+static constexpr u32 classify_group_size_ = 4;
+
+struct brick_cell_ {
+    u32 brick;
+    f32 distance;
+    u32 stamp;
+    u32 pad;
+};
+
+struct brick_pool_header_ {
+    s32 free_count;
+    u32 pad[3];
+};
+
+struct brick_bake_header_ {
+    VkDispatchIndirectCommand dispatch;
+    u32 pad;
+};
+
+struct brick_classify_settings_ {
+    u32 cell_lo[3];
+    u32 stamp;
+    u32 cell_count[3];
+    u32 pad;
+};
+
+struct cell_region_ {
+    u32 lo[3];
+    u32 hi[3];
+};
+
+static compute_pass classify_pass_;
+static compute_pass bake_pass_;
+
+static gpu_buffer pool_;
+static gpu_buffer bake_list_;
+
+static u32 stamp_;
+static bool needs_full_bake_;
+
+void init_brick_map_pass() {
+    ggfx->brick_grid = make_storage_buffer(cell_count_ * sizeof(brick_cell_));
+    pool_ = make_storage_buffer(sizeof(brick_pool_header_) + brick_count_ * sizeof(u32));
+    bake_list_ = make_indirect_buffer(sizeof(brick_bake_header_) + cell_count_ * sizeof(u32));
+
+    ggfx->brick_atlas = make_storage_texture_3d(
+        atlas_bricks_x_ * brick_voxels_, atlas_bricks_y_ * brick_voxels_, atlas_bricks_z_ * brick_voxels_,
+        VK_FORMAT_R16_SFLOAT);
+    ggfx->linear_sampler = make_linear_sampler();
+
+    // No bake uses brick_none_ as its stamp, so every cell gets classified the first time
+    brick_cell_ *cells = mem_allocv<brick_cell_>(cell_count_);
+    for (u32 i = 0; i < cell_count_; ++i) {
+        cells[i] = { brick_none_, 0.0f, brick_none_, 0 };
+    }
+
+    upload_buffer_blocking(ggfx->brick_grid, 0, cells, cell_count_ * sizeof(brick_cell_));
+    mem_freev(cells);
+
+    // Every brick starts out free
+    u32 *pool = mem_allocv<u32>(brick_count_);
+    for (u32 i = 0; i < brick_count_; ++i) {
+        pool[i] = brick_count_ - 1 - i;
+    }
+
+    brick_pool_header_ pool_header = { (s32)brick_count_ };
+    upload_buffer_blocking(pool_, 0, &pool_header, sizeof(pool_header));
+    upload_buffer_blocking(pool_, sizeof(pool_header), pool, brick_count_ * sizeof(u32));
+    mem_freev(pool);
+
+    classify_pass_ = make_compute_pass<brick_classify_settings_>(
+        "brick_classify",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+    );
+
+    bake_pass_ = make_compute_pass<no_push_constant>(
+        "brick_bake",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE }
+    );
+
+    ggfx->use_brick_map = true;
+    ggfx->is_brick_map_ready = false;
+    needs_full_bake_ = true;
+}
+
+void update_brick_map_controls() {
+    if (was_key_pressed(GLFW_KEY_F4)) {
+        ggfx->use_brick_map = !ggfx->use_brick_map;
+        log_info("brick map: %s", ggfx->use_brick_map ? "on" : "off");
+    }
+}
+
+/* Empty cells store bounds of up to max_empty_distance_, so an edit can make
+ * those wrong this far outside of its own bounds */
+static bool make_cell_region_(const aabb &bounds, cell_region_ &region) {
+    v3 lo = (bounds.min - v3(max_empty_distance_) - grid_lo_) / cell_size_;
+    v3 hi = (bounds.max + v3(max_empty_distance_) - grid_lo_) / cell_size_;
+
+    for (u32 i = 0; i < 3; ++i) {
+        if (hi[i] < 0.0f || lo[i] >= (f32)grid_size_) {
+            return false;
+        }
+
+        region.lo[i] = (u32)glm::max(lo[i], 0.0f);
+        region.hi[i] = glm::min((u32)hi[i] + 1, grid_size_);
+    }
+
+    return true;
+}
+
+// Runs after the LBVH, the cells get classified against the new blobs
+void run_brick_map_pass(render_graph &graph) {
+    // No tree to bake from while a CSG program runs, blob_cast doesn't sample the bricks then anyway
+    if (ggfx->is_csg_program_active) {
+        needs_full_bake_ = true;
+        ggfx->is_brick_map_ready = false;
+        return;
+    }
+
+    const small_vector<aabb, 16> &invalidated = ggfx->blob_view->invalidated;
+
+    // Culling scratch, only needed while this frame records
+    cell_region_ *regions = frame_allocv<cell_region_>(max_regions_);
+    u32 region_count = 0;
+
+    if (needs_full_bake_) {
+        regions[region_count++] = { { 0, 0, 0 }, { grid_size_, grid_size_, grid_size_ } };
+    }
+    else if (invalidated.size() > max_regions_) {
+        aabb merged = invalidated[0];
+        for (const aabb &bounds : invalidated) {
+            merged.min = glm::min(merged.min, bounds.min);
+            merged.max = glm::max(merged.max, bounds.max);
+        }
+
+        cell_region_ region;
+        if (make_cell_region_(merged, region)) {
+            regions[region_count++] = region;
+        }
+    }
+    else {
+        for (const aabb &bounds : invalidated) {
+            cell_region_ region;
+            if (make_cell_region_(bounds, region)) {
+                regions[region_count++] = region;
+            }
+        }
+    }
+
+    if (region_count == 0) {
+        return;
+    }
+
+    // Cells which still carry the stamp were classified by an earlier region
+    ++stamp_;
+    if (stamp_ == brick_none_) {
+        stamp_ = 0;
+    }
+
+    brick_bake_header_ header = {};
+    header.dispatch = { 0, 1, 1 };
+    bake_list_.update(graph, 0, sizeof(header), &header);
+
+    for (u32 r = 0; r < region_count; ++r) {
+        const cell_region_ &region = regions[r];
+        brick_classify_settings_ settings = {};
+        settings.stamp = stamp_;
+        for (u32 i = 0; i < 3; ++i) {
+            settings.cell_lo[i] = region.lo[i];
+            settings.cell_count[i] = region.hi[i] - region.lo[i];
+        }
+
+        classify_pass_.bind_resources(graph, &settings,
+            ggfx->blob_data, ggfx->blob_bvh, ggfx->brick_grid, pool_, bake_list_);
+
+        classify_pass_.run(graph,
+            (settings.cell_count[0] + classify_group_size_ - 1) / classify_group_size_,
+            (settings.cell_count[1] + classify_group_size_ - 1) / classify_group_size_,
+            (settings.cell_count[2] + classify_group_size_ - 1) / classify_group_size_);
+    }
+
+    bake_pass_.bind_resources<no_push_constant>(graph, nullptr,
+        ggfx->blob_data, ggfx->blob_bvh, ggfx->brick_grid, pool_, bake_list_, ggfx->brick_atlas);
+    bake_pass_.run_indirect(graph, bake_list_, offsetof(brick_bake_header_, dispatch));
+
+    needs_full_bake_ = false;
+    ggfx->is_brick_map_ready = true;
+}
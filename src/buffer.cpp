@@ -1,15 +1,27 @@
 #include "log.hpp"
+#include "memory.hpp"
 #include "buffer.hpp"
+#include "profiler.hpp"
 #include "render_context.hpp"
 #include "vulkan/vulkan_core.h"
 
+#include <algorithm>
+
+// The staging ring, see init_staging_ring
+static gpu_buffer staging_buffer_;
+static u32 staging_capacity_per_frame_;
+static u32 staging_frame_begin_;
+static u32 staging_used_;
+
 gpu_buffer::gpu_buffer() 
-: last_used_(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT) {
+: buffer_(VK_NULL_HANDLE), size_(0), memory_(VK_NULL_HANDLE), last_used_(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT), mapped_(nullptr),
+  descriptor_set_{} {
 
 }
 
 gpu_buffer::gpu_buffer(VkBuffer buf, u32 size, VkBufferUsageFlags usage) 
-: buffer_(buf), size_(size), last_used_(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT) {
+: buffer_(buf), size_(size), memory_(VK_NULL_HANDLE), last_used_(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT), mapped_(nullptr),
+  descriptor_set_{} {
     VkDescriptorType descriptor_type = VK_DESCRIPTOR_TYPE_MAX_ENUM;
     if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
         descriptor_type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
@@ -17,6 +29,10 @@ gpu_buffer::gpu_buffer(VkBuffer buf, u32 size, VkBufferUsageFlags usage)
     else if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
         descriptor_type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     }
+    else {
+        // Transfer only buffers (readback) don't get bound to shaders
+        return;
+    }
 
     buffer_descriptor_type type = (buffer_descriptor_type)convert_descriptor_type_vk_(descriptor_type);
 
@@ -61,6 +77,108 @@ void gpu_buffer::update(render_graph &graph, u32 offset, u32 size, void *data) {
         0, 0, nullptr, 1, &barrier, 0, nullptr);
 
     vkCmdUpdateBuffer(graph.command_buffer_, buffer_, offset, size, data);
+    count_upload_bytes(size);
+
+    last_used_ = VK_PIPELINE_STAGE_TRANSFER_BIT;
+}
+
+void gpu_buffer::destroy() {
+    for (VkDescriptorSet &set : descriptor_set_) {
+        if (set != VK_NULL_HANDLE) {
+            vkFreeDescriptorSets(gctx->device, gctx->descriptor_pool, 1, &set);
+            set = VK_NULL_HANDLE;
+        }
+    }
+
+    // Freeing the memory also unmaps it
+    vkDestroyBuffer(gctx->device, buffer_, nullptr);
+    vkFreeMemory(gctx->device, memory_, nullptr);
+
+    buffer_ = VK_NULL_HANDLE;
+    memory_ = VK_NULL_HANDLE;
+    mapped_ = nullptr;
+    size_ = 0;
+}
+
+void gpu_buffer::clear(render_graph &graph, u32 value, u32 size) {
+    size = std::min(size, size_);
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.size = size;
+    barrier.offset = 0;
+    barrier.buffer = buffer_;
+    barrier.srcAccessMask = find_access_flags_for_stage(last_used_);
+    barrier.dstAccessMask = find_access_flags_for_stage(VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    vkCmdPipelineBarrier(graph.command_buffer_, last_used_, VK_PIPELINE_STAGE_TRANSFER_BIT, 
+        0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    vkCmdFillBuffer(graph.command_buffer_, buffer_, 0, size, value);
+
+    last_used_ = VK_PIPELINE_STAGE_TRANSFER_BIT;
+}
+
+void gpu_buffer::copy_to(render_graph &graph, gpu_buffer &dst) {
+    VkBufferMemoryBarrier barriers[2] = {};
+    barriers[0].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barriers[0].size = size_;
+    barriers[0].buffer = buffer_;
+    barriers[0].srcAccessMask = find_access_flags_for_stage(last_used_);
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    barriers[1].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barriers[1].size = dst.size_;
+    barriers[1].buffer = dst.buffer_;
+    barriers[1].srcAccessMask = find_access_flags_for_stage(dst.last_used_);
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(graph.command_buffer_, last_used_ | dst.last_used_, VK_PIPELINE_STAGE_TRANSFER_BIT, 
+        0, 0, nullptr, 2, barriers, 0, nullptr);
+
+    VkBufferCopy region = {};
+    region.size = std::min(size_, dst.size_);
+    vkCmdCopyBuffer(graph.command_buffer_, buffer_, dst.buffer_, 1, &region);
+
+    last_used_ = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    if (dst.mapped_) {
+        // Make the copy visible to the host once the frame fence signals
+        VkBufferMemoryBarrier host_barrier = {};
+        host_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        host_barrier.size = dst.size_;
+        host_barrier.buffer = dst.buffer_;
+        host_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        vkCmdPipelineBarrier(graph.command_buffer_, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 
+            0, 0, nullptr, 1, &host_barrier, 0, nullptr);
+
+        dst.last_used_ = VK_PIPELINE_STAGE_HOST_BIT;
+    }
+    else {
+        dst.last_used_ = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+}
+
+void gpu_buffer::upload(render_graph &graph, u32 dst_offset, const staging_region &src) {
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.size = src.size;
+    barrier.offset = dst_offset;
+    barrier.buffer = buffer_;
+    barrier.srcAccessMask = find_access_flags_for_stage(last_used_);
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(graph.command_buffer_, last_used_, VK_PIPELINE_STAGE_TRANSFER_BIT, 
+        0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    VkBufferCopy region = {};
+    region.srcOffset = src.offset;
+    region.dstOffset = dst_offset;
+    region.size = src.size;
+    vkCmdCopyBuffer(graph.command_buffer_, staging_buffer_.buffer_, buffer_, 1, &region);
+    count_upload_bytes(src.size);
 
     last_used_ = VK_PIPELINE_STAGE_TRANSFER_BIT;
 }
@@ -107,9 +225,26 @@ void gpu_buffer::prepare_compute_resource_(render_graph &graph, VkDescriptorType
         default: panic_and_exit(); return;
     }
 
-    // Issue necessary memory barriers
-    vkCmdPipelineBarrier(graph.command_buffer_, ptr->last_used_, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-        0, 0, nullptr, 1, &barrier, 0, nullptr);
+    // Gets flushed together with the other resources of the dispatch
+    graph.add_barrier(ptr->last_used_, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, barrier);
+
+    ptr->last_used_ = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+}
+
+void gpu_buffer::prepare_indirect_(render_graph &graph) {
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.size = size_;
+    barrier.offset = 0;
+    barrier.buffer = buffer_;
+    barrier.srcAccessMask = find_access_flags_for_stage(last_used_);
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+    graph.add_barrier(last_used_, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, barrier);
+
+    // The indirect read is logically earlier than the dispatch's shaders, so
+    // waiting on the compute stage covers both
+    last_used_ = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
 }
 
 VkDescriptorSet *gpu_buffer::get_descriptor_sets() {
@@ -130,15 +265,19 @@ gpu_buffer make_uniform_buffer(u32 size) {
     vkCreateBuffer(gctx->device, &info, nullptr, &buf);
 
     // Just make it device local
-    allocate_buffer_memory(buf, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VkDeviceMemory memory = allocate_buffer_memory(buf, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    return gpu_buffer(buf, size, usage);
+    gpu_buffer result(buf, size, usage);
+    result.memory_ = memory;
+
+    return result;
 }
 
 gpu_buffer make_storage_buffer(u32 size) {
     VkBuffer buf;
 
-    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | 
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 
     VkBufferCreateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -149,7 +288,142 @@ gpu_buffer make_storage_buffer(u32 size) {
     vkCreateBuffer(gctx->device, &info, nullptr, &buf);
 
     // Just make it device local
-    allocate_buffer_memory(buf, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VkDeviceMemory memory = allocate_buffer_memory(buf, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    gpu_buffer result(buf, size, usage);
+    result.memory_ = memory;
+
+    return result;
+}
+
+gpu_buffer make_indirect_buffer(u32 size) {
+    VkBuffer buf;
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VkBufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.size = size;
+    info.usage = usage;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    vkCreateBuffer(gctx->device, &info, nullptr, &buf);
+
+    VkDeviceMemory memory = allocate_buffer_memory(buf, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    gpu_buffer result(buf, size, usage);
+    result.memory_ = memory;
+
+    return result;
+}
+
+gpu_buffer make_readback_buffer(u32 size) {
+    VkBuffer buf;
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    VkBufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.size = size;
+    info.usage = usage;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    vkCreateBuffer(gctx->device, &info, nullptr, &buf);
+
+    VkDeviceMemory memory = allocate_buffer_memory(buf, 
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    gpu_buffer result(buf, size, usage);
+    result.memory_ = memory;
+    vkMapMemory(gctx->device, memory, 0, size, 0, &result.mapped_);
+    zero_memory(result.mapped_, size);
+
+    return result;
+}
+
+gpu_buffer make_staging_buffer(u32 size) {
+    VkBuffer buf;
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VkBufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.size = size;
+    info.usage = usage;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    vkCreateBuffer(gctx->device, &info, nullptr, &buf);
+
+    // Coherent so host writes are visible when the command buffer is submitted
+    VkDeviceMemory memory = allocate_buffer_memory(buf, 
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    gpu_buffer result(buf, size, usage);
+    result.memory_ = memory;
+    vkMapMemory(gctx->device, memory, 0, size, 0, &result.mapped_);
+
+    return result;
+}
+
+// Copy offsets don't need more, but keep blob sized writes nicely aligned
+static constexpr u32 staging_alignment_ = 16;
+
+void init_staging_ring(u32 frames_in_flight, u32 capacity_per_frame) {
+    staging_capacity_per_frame_ = capacity_per_frame;
+    staging_buffer_ = make_staging_buffer(frames_in_flight * capacity_per_frame);
+
+    staging_frame_begin_ = 0;
+    staging_used_ = 0;
+}
+
+void begin_staging_ring(u32 frame) {
+    staging_frame_begin_ = frame * staging_capacity_per_frame_;
+    staging_used_ = 0;
+}
+
+staging_region staging_alloc(u32 size) {
+    u32 offset = (staging_used_ + staging_alignment_ - 1) & ~(staging_alignment_ - 1);
+
+    if (offset + size > staging_capacity_per_frame_) {
+        return { nullptr, 0, 0 };
+    }
+
+    staging_used_ = offset + size;
+
+    u32 ring_offset = staging_frame_begin_ + offset;
+    return { (u8 *)staging_buffer_.mapped() + ring_offset, ring_offset, size };
+}
+
+u32 get_staging_capacity() {
+    return staging_capacity_per_frame_;
+}
+
+void upload_buffer_blocking(gpu_buffer &dst, u32 dst_offset, const void *data, u32 size) {
+    VkCommandBuffer command_buffer;
+    VkCommandBufferAllocateInfo command_buffer_info = {};
+    command_buffer_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_info.commandBufferCount = 1;
+    command_buffer_info.commandPool = gctx->command_pool;
+    command_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    vkAllocateCommandBuffers(gctx->device, &command_buffer_info, &command_buffer);
+
+    // Nothing else is using the ring yet, so a chunk can span every frame's region
+    u32 chunk_size = staging_buffer_.size();
+    const u8 *src = (const u8 *)data;
+
+    for (u32 uploaded = 0; uploaded < size; uploaded += chunk_size) {
+        u32 current = std::min(chunk_size, size - uploaded);
+        memcpy(staging_buffer_.mapped(), src + uploaded, current);
+
+        render_graph graph (command_buffer, render_graph::one_time);
+        dst.upload(graph, dst_offset + uploaded, { (u8 *)staging_buffer_.mapped(), 0, current });
+
+        graph.submit(gctx->graphics_queue, VK_NULL_HANDLE, VK_NULL_HANDLE,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_NULL_HANDLE);
+
+        vkQueueWaitIdle(gctx->graphics_queue);
+    }
 
-    return gpu_buffer(buf, size, usage);
+    vkFreeCommandBuffers(gctx->device, gctx->command_pool, 1, &command_buffer);
 }
@@ -12,7 +12,21 @@ public:
     gpu_buffer();
     gpu_buffer(VkBuffer buf, u32 size, VkBufferUsageFlags usage);
 
+    // The GPU must be done with it
+    void destroy();
+
+    static constexpr u32 whole_size = 0xffffffff;
+
     void update(render_graph &, u32 offset, u32 size, void *data);
+    // Only the first size bytes (a multiple of 4) when given
+    void clear(render_graph &, u32 value = 0, u32 size = whole_size);
+    void copy_to(render_graph &, gpu_buffer &dst);
+    // Copies a region of the staging ring into this buffer
+    void upload(render_graph &, u32 dst_offset, const struct staging_region &src);
+
+    // Only valid for buffers made with make_readback_buffer
+    void *mapped() { return mapped_; }
+    u32 size() const { return size_; }
 
     VkDescriptorSet get_descriptor_set(VkDescriptorType type) override;
 
@@ -21,6 +35,8 @@ private:
     static VkDescriptorType convert_descriptor_type_(buffer_descriptor_type type);
 
     static void prepare_compute_resource_(render_graph &graph, VkDescriptorType type, void *);
+    // Before a dispatch reads its group counts from this buffer
+    void prepare_indirect_(render_graph &graph);
 
     VkDescriptorSet *get_descriptor_sets();
 
@@ -30,10 +46,43 @@ private:
     VkDeviceMemory memory_;
     VkPipelineStageFlags last_used_;
     VkAccessFlags last_access_;
+    void *mapped_;
 
     VkDescriptorSet descriptor_set_[(u32)buffer_descriptor_type::max_enum];
 
     friend class compute_pass;
+    friend gpu_buffer make_uniform_buffer(u32 size);
+    friend gpu_buffer make_storage_buffer(u32 size);
+    friend gpu_buffer make_indirect_buffer(u32 size);
+    friend gpu_buffer make_readback_buffer(u32 size);
+    friend gpu_buffer make_staging_buffer(u32 size);
 };
 
 gpu_buffer make_uniform_buffer(u32 size);
+gpu_buffer make_storage_buffer(u32 size);
+// Storage buffer which can also hold VkDispatchIndirectCommands (compute_pass::run_indirect)
+gpu_buffer make_indirect_buffer(u32 size);
+// Host visible and persistently mapped, GPU results get copied into these
+gpu_buffer make_readback_buffer(u32 size);
+// Host visible, persistently mapped transfer source
+gpu_buffer make_staging_buffer(u32 size);
+
+/* Upload memory for everything bigger than a few vkCmdUpdateBuffer calls.
+ * One host visible buffer split into a region per frame in flight, which
+ * gets reset once the frame's fence has signaled (like the frame allocator).
+ * Data is written straight into the mapping and copied on the GPU timeline. */
+struct staging_region {
+    u8 *data;
+    u32 offset;
+    u32 size;
+};
+
+void init_staging_ring(u32 frames_in_flight, u32 capacity_per_frame);
+void begin_staging_ring(u32 frame);
+// Size is 0 when this frame's region is used up, the caller should retry next frame
+staging_region staging_alloc(u32 size);
+u32 get_staging_capacity();
+
+// Outside the frame loop (loading): streams the data through the whole ring
+// in chunks, waiting for the GPU after each one
+void upload_buffer_blocking(gpu_buffer &dst, u32 dst_offset, const void *data, u32 size);
@@ -1,8 +1,30 @@
 #include "compute.hpp"
 #include <filesystem>
 
-compute_pass::compute_pass(const char *src_path, u32 push_constant_size, const buffer<uprototype> &uniforms) 
-: descriptor_types_(uniforms.size) {
+compute_pass::compute_pass(const char *src_path, u32 push_constant_size, const buffer<uprototype> &uniforms) {
+    // SPIR-V goes straight from the page cache into the driver
+    mapped_file src_file(make_shader_src_path(src_path), map_hint_sequential);
+    if (!src_file.is_open()) {
+        panic_and_exit();
+    }
+
+    buffer<const u8> src_bytes = src_file.bytes();
+    init_((const u32 *)src_bytes.data, src_bytes.size, push_constant_size, uniforms);
+}
+
+compute_pass::compute_pass(buffer<const u32> spirv, u32 push_constant_size, const buffer<uprototype> &uniforms) {
+    init_(spirv.data, spirv.size * sizeof(u32), push_constant_size, uniforms);
+}
+
+void compute_pass::destroy() {
+    vkDestroyPipeline(gctx->device, pipeline_, nullptr);
+    vkDestroyPipelineLayout(gctx->device, layout_, nullptr);
+    pipeline_ = VK_NULL_HANDLE;
+    layout_ = VK_NULL_HANDLE;
+    descriptor_types_.clear();
+}
+
+void compute_pass::init_(const u32 *code, u32 code_size, u32 push_constant_size, const buffer<uprototype> &uniforms) {
     // Push constant
     VkPushConstantRange push_constant_range = {};
     push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;;
@@ -13,7 +35,7 @@ compute_pass::compute_pass(const char *src_path, u32 push_constant_size, const b
     VkDescriptorSetLayout *layouts = stack_alloc(VkDescriptorSetLayout, uniforms.size);
     for (u32 i = 0; i < uniforms.size; ++i) {
         layouts[i] = get_descriptor_set_layout(uniforms[i].type, uniforms[i].count ? uniforms[i].count : 1);
-        descriptor_types_[i] = uniforms[i].type;
+        descriptor_types_.push_back(uniforms[i].type);
     }
 
     VkPipelineLayoutCreateInfo pipeline_layout_info = {};
@@ -29,15 +51,11 @@ compute_pass::compute_pass(const char *src_path, u32 push_constant_size, const b
     VK_CHECK(vkCreatePipelineLayout(gctx->device, &pipeline_layout_info, nullptr, &layout_));
 
     // Shader stage
-    heap_array<u8> src_bytes = file(
-        make_shader_src_path(src_path), 
-        file_type_bin | file_type_in).read_binary();
-
     VkShaderModule shader_module;
     VkShaderModuleCreateInfo shader_info = {};
     shader_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    shader_info.codeSize = src_bytes.size();
-    shader_info.pCode = (u32 *)src_bytes.data();
+    shader_info.codeSize = code_size;
+    shader_info.pCode = code;
 
     VK_CHECK(vkCreateShaderModule(gctx->device, &shader_info, NULL, &shader_module));
 
@@ -53,15 +71,15 @@ compute_pass::compute_pass(const char *src_path, u32 push_constant_size, const b
     compute_pipeline_info.layout = layout_;
 
     VK_CHECK(vkCreateComputePipelines(gctx->device, VK_NULL_HANDLE, 1, &compute_pipeline_info, nullptr, &pipeline_));
+
+    // The pipeline has everything it needs from the module
+    vkDestroyShaderModule(gctx->device, shader_module, nullptr);
 }
 
 std::string compute_pass::make_shader_src_path(const char *path) const {
     std::string str_path = path;
-    str_path = std::string(MIRAGE_PROJECT_ROOT) +
-        (char)std::filesystem::path::preferred_separator +
-        std::string("res") + 
-        (char)std::filesystem::path::preferred_separator +
-        std::string("spv") + 
+    // Where the build compiled the shaders to (CMakeLists.txt)
+    str_path = std::string(MIRAGE_SPV_DIR) +
         (char)std::filesystem::path::preferred_separator +
         str_path +
         ".comp.spv";
@@ -2,8 +2,10 @@
 
 #include "file.hpp"
 #include <type_traits>
+#include "buffer.hpp"
 #include "uniform.hpp"
 #include "heap_array.hpp"
+#include "small_vector.hpp"
 #include "render_graph.hpp"
 #include <vulkan/vulkan.hpp>
 #include "render_context.hpp"
@@ -17,6 +19,11 @@ public:
     compute_pass() = default;
 
     compute_pass(const char *src_path, u32 push_constant_size, const buffer<uprototype> &uniforms);
+    // From SPIR-V compiled at runtime (scene_shader.cpp)
+    compute_pass(buffer<const u32> spirv, u32 push_constant_size, const buffer<uprototype> &uniforms);
+
+    // Only once no command buffer which uses the pass is in flight anymore
+    void destroy();
 
     // This 
     template <typename PK, typename ...T>
@@ -43,6 +50,8 @@ public:
             prepare_procs[i](graph, descriptor_types_[i], resources_raw_ptr[i]);
         }
 
+        graph.flush_barriers();
+
         vkCmdBindDescriptorSets(graph.command_buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, layout_, 0, sizeof...(T), descriptor_sets, 0, nullptr);
     }
 
@@ -51,15 +60,24 @@ public:
         vkCmdDispatch(graph.command_buffer_, count_x, count_y, count_z);
     }
 
-    // void run(render_graph &graph, iv3)
+    // Group counts come from a VkDispatchIndirectCommand at offset in args,
+    // written by an earlier pass, so no CPU readback is needed to size this one
+    void run_indirect(render_graph &graph, gpu_buffer &args, u32 offset) {
+        args.prepare_indirect_(graph);
+        graph.flush_barriers();
+
+        vkCmdBindPipeline(graph.command_buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+        vkCmdDispatchIndirect(graph.command_buffer_, args.buffer_, offset);
+    }
 
 private:
+    void init_(const u32 *code, u32 code_size, u32 push_constant_size, const buffer<uprototype> &uniforms);
     std::string make_shader_src_path(const char *path) const;
 
 private:
     VkPipeline pipeline_;
     VkPipelineLayout layout_;
-    heap_array<VkDescriptorType> descriptor_types_;
+    small_vector<VkDescriptorType, 8> descriptor_types_;
 };
 
 template <typename ...UP>
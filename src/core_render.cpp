@@ -3,7 +3,11 @@
 #include "memory.hpp"
 #include "buffer.hpp"
 #include "compute.hpp"
+#include "profiler.hpp"
+#include "gpu_primitives.hpp"
+#include "debug_overlay.hpp"
 #include "core_render.hpp"
+#include "scene_shader.hpp"
 #include "render_context.hpp"
 
 graphics_resources *ggfx;
@@ -20,17 +24,19 @@ static u32 max_frames_in_flight_;
 // Command buffers
 static heap_array<VkCommandBuffer> command_buffers_;
 
-void init_core_render() {
-    ggfx = mem_alloc<graphics_resources>();
+void init_core_render(const char *scene_path) {
+    ggfx = arena_alloc<graphics_resources>();
 
     // Swapchain/final targets
-    ggfx->swapchain_targets = heap_array<texture>(gctx->images.size());
-    for (u32 i = 0; i < ggfx->swapchain_targets.size(); ++i) {
-        ggfx->swapchain_targets[i] = texture(gctx->images[i], gctx->image_views[i], texture_descriptor_type::storage_image);
+    ggfx->swapchain_targets.reserve(gctx->images.size());
+    for (u32 i = 0; i < gctx->images.size(); ++i) {
+        ggfx->swapchain_targets.emplace_back(gctx->images[i], gctx->image_views[i], texture_descriptor_type::storage_image);
     }
 
     // Synchronisation
     max_frames_in_flight_ = 2;
+    init_frame_allocator(max_frames_in_flight_, megabytes(8));
+    init_profiler(max_frames_in_flight_);
     image_ready_semaphores_ = heap_array<VkSemaphore>(max_frames_in_flight_);
     render_finished_semaphores_ = heap_array<VkSemaphore>(max_frames_in_flight_);
     fences_ = heap_array<VkFence>(max_frames_in_flight_);
@@ -59,40 +65,101 @@ void init_core_render() {
 
     // Initialize some resources
     ggfx->time_uniform_data = make_uniform_buffer(sizeof(time_data));
-    init_blobs();
+    init_staging_ring(max_frames_in_flight_, megabytes(8));
+    init_blobs(scene_path);
 
     // Compute and render passes
+    // Enough for the LBVH
+    init_gpu_primitives(ggfx->blobs->capacity);
+    init_lbvh_pass();
+    init_distance_pyramid_pass();
+    init_occupancy_pass();
+    init_brick_map_pass();
     init_final_pass();
+    init_march_cost_pass(max_frames_in_flight_);
+
+    init_debug_overlay();
 }
 
 void run_render() {
     poll_input();
+    update_march_cost_controls();
+    update_brick_map_controls();
 
     // Get swapchain image
     u32 swapchain_image_idx = acquire_next_swapchain_image(image_ready_semaphores_[current_frame_]);
     vkWaitForFences(gctx->device, 1, &fences_[current_frame_], true, UINT64_MAX);
     vkResetFences(gctx->device, 1, &fences_[current_frame_]);
 
+    // Nothing the GPU reads from this frame's scratch memory is in flight anymore
+    begin_frame_allocator(current_frame_);
+    begin_staging_ring(current_frame_);
+
+    // Results which were written the last time this frame was in flight
+    read_march_cost_stats(current_frame_);
+    read_profiler_results(current_frame_);
+
     VkCommandBuffer current_command_buffer = command_buffers_[swapchain_image_idx];
 
     // Begin command buffer
     render_graph graph (current_command_buffer);
+    begin_profiler_frame(graph, current_frame_);
 
     // Update uniform data
+    u32 upload_zone = begin_gpu_zone(graph, "uploads");
     time_data tdata = { gtime->frame_dt, gtime->current_time };
     ggfx->time_uniform_data.update(graph, 0, sizeof(time_data), &tdata);
-    // Update blobs and uniform buffer for them
-    update_blobs(graph);
+    // Upload whatever blobs changed
+    bool is_blob_data_changed = update_blobs(graph);
+    end_gpu_zone(graph, upload_zone);
+
+    update_scene_shader();
+
+    if (is_blob_data_changed) {
+        u32 lbvh_zone = begin_gpu_zone(graph, "lbvh");
+        run_lbvh_pass(graph);
+        end_gpu_zone(graph, lbvh_zone);
+
+        u32 pyramid_zone = begin_gpu_zone(graph, "distance_pyramid");
+        run_distance_pyramid_pass(graph);
+        end_gpu_zone(graph, pyramid_zone);
+
+        u32 occupancy_zone = begin_gpu_zone(graph, "occupancy");
+        run_occupancy_pass(graph);
+        end_gpu_zone(graph, occupancy_zone);
+
+        u32 brick_zone = begin_gpu_zone(graph, "brick_map");
+        run_brick_map_pass(graph);
+        end_gpu_zone(graph, brick_zone);
+    }
 
     // Run all passes
-    run_final_pass(graph, ggfx->swapchain_targets[swapchain_image_idx]);
+    if (ggfx->is_instrumented) {
+        begin_march_cost(graph);
+    }
+
+    u32 final_zone = begin_gpu_zone(graph, "blob_cast");
+    run_final_pass(graph, ggfx->swapchain_targets[swapchain_image_idx], is_blob_data_changed);
+    end_gpu_zone(graph, final_zone);
+
+    if (ggfx->is_instrumented) {
+        u32 cost_zone = begin_gpu_zone(graph, "march_cost");
+        run_march_cost_pass(graph, ggfx->swapchain_targets[swapchain_image_idx], current_frame_);
+        end_gpu_zone(graph, cost_zone);
+    }
+
+    u32 overlay_zone = begin_gpu_zone(graph, "overlay");
+    render_debug_overlay(graph, ggfx->swapchain_targets[swapchain_image_idx], swapchain_image_idx);
+    end_gpu_zone(graph, overlay_zone);
 
     ggfx->swapchain_targets[swapchain_image_idx].transition_layout(graph, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    end_profiler_frame(graph);
 
     // Submit command buffer
     graph.submit(gctx->graphics_queue, image_ready_semaphores_[current_frame_], 
         render_finished_semaphores_[current_frame_], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 
         fences_[current_frame_]);
+    end_profiler_submit();
 
     // Present to screen
     present_swapchain_image(render_finished_semaphores_[current_frame_], swapchain_image_idx);
@@ -4,24 +4,89 @@
 #include "types.hpp"
 #include "buffer.hpp"
 #include "texture.hpp"
+#include "small_vector.hpp"
 #include "render_graph.hpp"
 
 #include <vulkan/vulkan.h>
 
+// Totals written by blob_cast_instrumented (matches cost_counters in march_cost.glsl)
+struct march_cost_stats {
+    u32 march_steps;
+    u32 shadow_steps;
+    u32 map_calls;
+    u32 hit_pixels;
+};
+
 // All renderer resources (textures, uniforms, pipelines, etc...)
 extern struct graphics_resources {
     // Textures, buffers, etc...
-    heap_array<texture> swapchain_targets;
+    small_vector<texture, 4> swapchain_targets;
     gpu_buffer time_uniform_data;
     // All blobs will be stored here one after the other without spatial organization
     // TODO: Add octree structure to better organize them and make iteration more efficient
     gpu_buffer blob_data;
-    blob_array *blobs;
+    // Owned by the simulation thread, the render thread only sees the snapshots (see sim.hpp)
+    blob_store *blobs;
+    const blob_snapshot *blob_view;
+    // Bytecode of the scene's CSG tree, active when the scene has one (csg.hpp)
+    gpu_buffer csg_program;
+    u32 is_csg_program_active : 1;
+    // Where the program's surface can be, tile_classify culls against it
+    v3 csg_lo;
+    v3 csg_hi;
+    // Linear BVH over blob_data, see lbvh_pass.cpp
+    gpu_buffer blob_bvh;
+    // Dispatch arguments and tile list written by tile_classify, see final_pass.cpp
+    gpu_buffer tile_work;
+    // Blobs each hit tile has to march (tile_blobs.glsl)
+    gpu_buffer tile_blobs;
+    // Sparse brick cache of the blob field, see brick_map_pass.cpp (F4 toggles)
+    gpu_buffer brick_grid;
+    texture brick_atlas;
+    texture_sampler linear_sampler;
+    u32 use_brick_map : 1;
+    u32 is_brick_map_ready : 1;
+    // Distance bounds for empty space skipping, see distance_pyramid_pass.cpp
+    texture distance_pyramid;
+    // Low corner and level 0 cell size, fitted to the static blobs. The occupancy grid covers it too
+    v4 pyramid_region;
+    u32 is_distance_pyramid_ready : 1;
+    // Bit per cell of where the surface may be, see occupancy_pass.cpp
+    gpu_buffer occupancy_grid;
+    u32 is_occupancy_ready : 1;
+
+    // Debug instrumentation (F1 toggles, F2 cycles the heatmap channel)
+    u32 is_instrumented : 1;
+    u32 show_march_cost : 1;
+    texture march_cost_image;
+    gpu_buffer march_cost_counters;
+    march_cost_stats march_stats;
 } *ggfx;
 
-void init_core_render();
+// Scene file to load, nullptr for the built in scene
+void init_core_render(const char *scene_path);
 void run_render();
 
 // All rendering functionality
 void init_final_pass();
-void run_final_pass(render_graph &, texture &target);
+// is_blob_data_changed: what update_blobs returned this frame
+void run_final_pass(render_graph &, texture &target, bool is_blob_data_changed);
+
+void init_lbvh_pass();
+void run_lbvh_pass(render_graph &);
+
+void init_distance_pyramid_pass();
+void run_distance_pyramid_pass(render_graph &);
+
+void init_occupancy_pass();
+void run_occupancy_pass(render_graph &);
+
+void init_brick_map_pass();
+void update_brick_map_controls();
+void run_brick_map_pass(render_graph &);
+
+void init_march_cost_pass(u32 frames_in_flight);
+void update_march_cost_controls();
+void read_march_cost_stats(u32 frame);
+void begin_march_cost(render_graph &);
+void run_march_cost_pass(render_graph &, texture &target, u32 frame);
@@ -0,0 +1,260 @@
+#include "csg.hpp"
+#include "log.hpp"
+#include "blob.hpp"
+
+#include <algorithm>
+#include <glm/gtc/packing.hpp>
+
+static constexpr u32 empty_ = 0xffffffff;
+
+// Tree after folding, children still come before their parents
+struct folded_node_ {
+    u32 op;
+    f32 smoothing;
+    // Folded children, the dense blob index for leaves
+    u32 left;
+    u32 right;
+    // Where the surface of the subtree can be
+    aabb bounds;
+    // Registers needed to evaluate the subtree
+    u32 need;
+};
+
+struct emit_frame_ {
+    u32 node;
+    bool are_children_done;
+};
+
+static bool is_smooth_(u32 op) {
+    return op >= sdf_smooth_add;
+}
+
+// sdf_smooth_add -> sdf_add etc.
+static u32 hard_op_(u32 op) {
+    return is_smooth_(op) ? op - sdf_smooth_add : op;
+}
+
+static aabb grow_(const aabb &b, f32 distance) {
+    return { b.min - v3(distance), b.max + v3(distance) };
+}
+
+static bool do_overlap_(const aabb &a, const aabb &b) {
+    return glm::all(glm::lessThanEqual(a.min, b.max)) && glm::all(glm::lessThanEqual(b.min, a.max));
+}
+
+static u32 fold_leaf_(small_vector<folded_node_, 64> &folded, const csg_node &node) {
+    blob_handle handle = { node.left, node.right };
+    if (node.left == csg_no_blob || !is_blob_alive(handle)) {
+        return empty_;
+    }
+
+    // get_blob_bounds includes the default blend, the ops add their own
+    aabb bounds = grow_(get_blob_bounds(get_blob(handle)), -blob_smoothing);
+
+    folded.push_back({ csg_op_leaf, 0.0f, get_blob_index(handle), 0, bounds, 1 });
+    return folded.size() - 1;
+}
+
+/* An empty operand is the field of nothing. Smooth blends only reach their
+ * smoothing past a surface: a subtraction further than that from what it
+ * subtracts from leaves it alone, an intersection of operands which don't
+ * overlap is empty, and a union of operands further apart than the
+ * smoothing blends nowhere near the surface (so a plain min does). */
+static u32 fold_op_(small_vector<folded_node_, 64> &folded, const csg_node &node, u32 left, u32 right) {
+    u32 op = node.op;
+    f32 k = node.smoothing;
+
+    // Also catches NaN
+    if (is_smooth_(op) && !(k > 0.0f)) {
+        op = hard_op_(op);
+    }
+
+    f32 blend = is_smooth_(op) ? k : 0.0f;
+    aabb bounds;
+
+    switch (hard_op_(op)) {
+    case sdf_add: {
+        if (left == empty_ || right == empty_) {
+            return left == empty_ ? right : left;
+        }
+
+        const aabb &a = folded[left].bounds;
+        const aabb &b = folded[right].bounds;
+        if (is_smooth_(op) && !do_overlap_(grow_(a, k), b)) {
+            op = hard_op_(op);
+            blend = 0.0f;
+        }
+
+        // The blend pulls the surface out by up to k / 4
+        bounds = grow_({ glm::min(a.min, b.min), glm::max(a.max, b.max) }, blend * 0.25f);
+    } break;
+
+    case sdf_sub: {
+        if (left == empty_ || right == empty_) {
+            return left;
+        }
+
+        if (!do_overlap_(grow_(folded[left].bounds, blend), folded[right].bounds)) {
+            return left;
+        }
+
+        bounds = folded[left].bounds;
+    } break;
+
+    case sdf_intersect: {
+        if (left == empty_ || right == empty_) {
+            return empty_;
+        }
+
+        const aabb &a = folded[left].bounds;
+        const aabb &b = folded[right].bounds;
+        if (!do_overlap_(a, b)) {
+            return empty_;
+        }
+
+        bounds = { glm::max(a.min, b.min), glm::min(a.max, b.max) };
+    } break;
+
+    default:
+        log_warning("Unknown CSG op %u, dropping the subtree", node.op);
+        return empty_;
+    }
+
+    // Blobs can only be the second operand of an op, union and intersection don't mind the order
+    bool is_symmetric = hard_op_(op) != sdf_sub;
+    if (is_symmetric && folded[left].op == csg_op_leaf && folded[right].op != csg_op_leaf) {
+        std::swap(left, right);
+    }
+
+    u32 left_need = folded[left].need;
+    u32 right_need = folded[right].need;
+
+    u32 need;
+    if (folded[right].op == csg_op_leaf) {
+        need = left_need;
+    }
+    else {
+        need = left_need == right_need ? left_need + 1 : std::max(left_need, right_need);
+    }
+
+    folded.push_back({ op, blend, left, right, bounds, need });
+    return folded.size() - 1;
+}
+
+static u32 encode_(u32 opcode, u32 dst, u32 a, u32 b, f32 smoothing) {
+    return opcode | (dst << 3) | (a << 7) | (b << 11) | ((u32)glm::packHalf1x16(smoothing) << 16);
+}
+
+static u32 allocate_register_(u32 &used) {
+    u32 reg = 0;
+    while (used & (1 << reg)) {
+        ++reg;
+    }
+
+    used |= 1 << reg;
+    return reg;
+}
+
+// Walks the folded tree without recursion, scene trees can be long chains
+static void emit_(const small_vector<folded_node_, 64> &folded, u32 root, csg_program &program) {
+    small_vector<emit_frame_, 64> frames;
+    // Registers holding the results of the subtrees evaluated so far
+    small_vector<u32, csg_register_count> results;
+    u32 used = 0;
+
+    frames.push_back({ root, false });
+
+    while (!frames.empty()) {
+        emit_frame_ frame = frames.back();
+        const folded_node_ &node = folded[frame.node];
+
+        if (node.op == csg_op_leaf) {
+            frames.pop_back();
+
+            u32 dst = allocate_register_(used);
+            program.code.push_back({ encode_(csg_load, dst, 0, 0, 0.0f), node.left });
+            results.push_back(dst);
+            program.register_count = std::max(program.register_count, dst + 1);
+            continue;
+        }
+
+        u32 opcode = csg_union + node.op;
+        bool is_blob_operand = folded[node.right].op == csg_op_leaf;
+
+        if (!frame.are_children_done) {
+            frames.back().are_children_done = true;
+
+            if (is_blob_operand) {
+                frames.push_back({ node.left, false });
+            }
+            else {
+                // The subtree which needs more registers goes first, the one pushed last runs first
+                bool is_left_first = folded[node.left].need >= folded[node.right].need;
+                frames.push_back({ is_left_first ? node.right : node.left, false });
+                frames.push_back({ is_left_first ? node.left : node.right, false });
+            }
+
+            continue;
+        }
+
+        frames.pop_back();
+
+        if (is_blob_operand) {
+            u32 a = results.back();
+            program.code.push_back({ encode_(opcode, a, a, 0, node.smoothing) | csg_code_blob_operand, folded[node.right].left });
+            continue;
+        }
+
+        u32 second = results.back();
+        results.pop_back();
+        u32 first = results.back();
+        results.pop_back();
+
+        bool is_left_first = folded[node.left].need >= folded[node.right].need;
+        u32 a = is_left_first ? first : second;
+        u32 b = is_left_first ? second : first;
+
+        program.code.push_back({ encode_(opcode, a, a, b, node.smoothing), 0 });
+        used &= ~(1 << b);
+        results.push_back(a);
+    }
+
+    program.result_register = results.back();
+}
+
+bool compile_csg(const csg_node *nodes, u32 count, csg_program &program) {
+    program.code.clear();
+    program.result_register = 0;
+    program.register_count = 0;
+    program.lo = v3(1.0f);
+    program.hi = v3(-1.0f);
+
+    if (!count) {
+        return true;
+    }
+
+    small_vector<folded_node_, 64> folded;
+    small_vector<u32, 64> remap;
+    remap.resize(count);
+
+    for (u32 i = 0; i < count; ++i) {
+        const csg_node &node = nodes[i];
+        remap[i] = node.op == csg_op_leaf ? fold_leaf_(folded, node) : fold_op_(folded, node, remap[node.left], remap[node.right]);
+    }
+
+    u32 root = remap[count - 1];
+    if (root == empty_) {
+        // Nothing left, the field is empty everywhere
+        return true;
+    }
+
+    if (folded[root].need > csg_register_count) {
+        log_error("CSG tree needs %u registers, only %u are available", folded[root].need, csg_register_count);
+        return false;
+    }
+
+    emit_(folded, root, program);
+    program.lo = folded[root].bounds.min;
+    program.hi = folded[root].bounds.max;
+    return true;
+}
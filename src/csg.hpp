@@ -0,0 +1,75 @@
+#pragma once
+
+#include "types.hpp"
+#include "small_vector.hpp"
+
+/* CSG trees over the blobs. Without one, the field is the fixed pattern of
+ * blob_map.glsl (smoothly add every addition, then subtract every
+ * subtraction). A scene can instead give a tree with any ordering and
+ * grouping of the ops in blob.hpp, which gets compiled into a flat register
+ * bytecode that blob_cast interprets (csg.glsl). */
+
+// op of the leaves, everything else is an op_type
+constexpr u32 csg_op_leaf = 0xffffffff;
+// Leaf whose blob is gone, folds away like an empty subtree
+constexpr u32 csg_no_blob = 0xffffffff;
+
+/* Children always come before their parent, the last node is the root.
+ * Leaves keep their blob in left: a dense index in scene files, the handle
+ * (slot in left, generation in right) in the blob store. */
+struct csg_node {
+    u32 op;
+    // Blend width of the smooth ops
+    f32 smoothing;
+    u32 left;
+    u32 right;
+};
+
+static_assert(sizeof(csg_node) == 16, "csg_node is part of the scene format");
+
+// Same as csg.glsl
+enum csg_opcode : u32 {
+    // dst = the blob's distance
+    csg_load,
+    // dst = op(a, b), b is a blob instead of a register with csg_code_blob_operand
+    csg_union,
+    csg_sub,
+    csg_intersect,
+    csg_smooth_union,
+    csg_smooth_sub,
+    csg_smooth_intersect
+};
+
+constexpr u32 csg_register_count = 16;
+
+/* code: opcode (3 bits), dst (4), a (4), b (4), blob operand (1), the
+ * smoothing as a half float (16). blob: the dense index of the blob operand */
+struct csg_instruction {
+    u32 code;
+    u32 blob;
+};
+
+constexpr u32 csg_code_blob_operand = 1 << 15;
+
+// Start of the program buffer, the instructions follow right after
+struct csg_program_header {
+    u32 instruction_count;
+    u32 result_register;
+    u32 pad[2];
+};
+
+struct csg_program {
+    small_vector<csg_instruction, 32> code;
+    u32 result_register;
+    u32 register_count;
+    // Where the surface can be, blends included. lo > hi when the field is empty
+    v3 lo;
+    v3 hi;
+};
+
+/* Folds constants (gone blobs, empty operands, smoothing of 0), removes the
+ * branches the bounds of the blobs prove can't change the surface and
+ * allocates registers (Sethi-Ullman order, blobs fused into the ops which
+ * use them). Simulation thread only, leaves are resolved through their
+ * handles. False when the tree needs more than csg_register_count registers. */
+bool compile_csg(const csg_node *nodes, u32 count, csg_program &program);
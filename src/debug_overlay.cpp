@@ -4,10 +4,19 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_vulkan.h>
 
+#include "jobs.hpp"
+#include "sim.hpp"
+#include "memory.hpp"
+#include "profiler.hpp"
+#include "core_render.hpp"
 #include "render_graph.hpp"
 #include "debug_overlay.hpp"
 #include "render_context.hpp"
 
+// One framebuffer per swapchain image for the overlay render pass
+static heap_array<VkFramebuffer> framebuffers_;
+static bool is_visible_ = true;
+
 static void imgui_callback_(VkResult result) {
     (void)result;
 }
@@ -27,8 +36,9 @@ void init_debug_overlay() {
     attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    // The swapchain texture tracks its own layout and transitions to present afterwards
     attachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference color_attachment = {};
     color_attachment.attachment = 0;
@@ -58,6 +68,20 @@ void init_debug_overlay() {
 
     VK_CHECK(vkCreateRenderPass(gctx->device, &info, nullptr, &gctx->imgui_render_pass));
 
+    framebuffers_ = heap_array<VkFramebuffer>(gctx->image_views.size());
+    for (u32 i = 0; i < framebuffers_.size(); ++i) {
+        VkFramebufferCreateInfo framebuffer_info = {};
+        framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebuffer_info.renderPass = gctx->imgui_render_pass;
+        framebuffer_info.attachmentCount = 1;
+        framebuffer_info.pAttachments = &gctx->image_views[i];
+        framebuffer_info.width = gctx->swapchain_extent.width;
+        framebuffer_info.height = gctx->swapchain_extent.height;
+        framebuffer_info.layers = 1;
+
+        VK_CHECK(vkCreateFramebuffer(gctx->device, &framebuffer_info, nullptr, &framebuffers_[i]));
+    }
+
     ImGui_ImplGlfw_InitForVulkan(window, true);
     ImGui_ImplVulkan_InitInfo init_info = {};
     init_info.Instance = gctx->instance;
@@ -89,29 +113,146 @@ void init_debug_overlay() {
 
     graph.submit(gctx->graphics_queue, VK_NULL_HANDLE, VK_NULL_HANDLE,
         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_NULL_HANDLE);
+
+    vkQueueWaitIdle(gctx->graphics_queue);
+    ImGui_ImplVulkan_DestroyFontUploadObjects();
+    vkFreeCommandBuffers(gctx->device, gctx->command_pool, 1, &command_buffer);
 }
 
-void render_debug_overlay(render_graph &graph) {
-    // Start a render pass
+static void render_performance_window_() {
+    const profiler_data *p = gprofiler;
 
+    ImGui::Begin("Performance");
+    ImGui::Text("Framerate: %.1f", ImGui::GetIO().Framerate);
 
-    ImGui_ImplVulkan_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
-    ImGui::NewFrame();
+    u32 newest = (p->history_offset + profiler_history_length - 1) % profiler_history_length;
 
-    // General stuff
-    ImGui::Begin("General");
-    ImGui::Text("Framerate: %.1f", ImGui::GetIO().Framerate);
+    char overlay[64];
+    snprintf(overlay, sizeof(overlay), "CPU %.2f ms", p->cpu_frame_ms[newest]);
+    ImGui::PlotLines("##cpu", p->cpu_frame_ms, profiler_history_length, p->history_offset,
+        overlay, 0.0f, 33.3f, ImVec2(0, 60));
+
+    snprintf(overlay, sizeof(overlay), "GPU %.2f ms", p->gpu_frame_ms[newest]);
+    ImGui::PlotLines("##gpu", p->gpu_frame_ms, profiler_history_length, p->history_offset,
+        overlay, 0.0f, 33.3f, ImVec2(0, 60));
+
+    ImGui::Text("CPU record: %.3f ms (%u job threads)", p->cpu_record_ms, get_job_thread_count());
+
+    if (ImGui::CollapsingHeader("GPU passes", ImGuiTreeNodeFlags_DefaultOpen)) {
+        for (u32 i = 0; i < p->zone_count; ++i) {
+            ImGui::Text("%-16s %.3f ms", p->zones[i].name, p->zones[i].ms);
+        }
+    }
+
+    ImGui::Separator();
+    const blob_snapshot *snapshot = ggfx->blob_view;
+    ImGui::Text("Blobs: %u", snapshot->header.count);
+    ImGui::Text("Sim: tick %llu, %.3f ms", (unsigned long long)snapshot->tick, snapshot->sim_ms);
+
+    if (ImGui::CollapsingHeader("Edits")) {
+        ImGui::Text("Journal: %llu records, %llu compactions%s", 
+            (unsigned long long)snapshot->journal_record_count,
+            (unsigned long long)snapshot->journal_compaction_count,
+            snapshot->is_journal_compacting ? " (compacting)" : "");
+        ImGui::Text("Undo: %u edits", snapshot->undo_count);
+        ImGui::Text("Dropped commands: %llu", (unsigned long long)get_dropped_blob_command_count());
+
+        blob_command command = {};
+
+        if (ImGui::Button("Add sphere")) {
+            f32 angle = (f32)snapshot->header.count;
+            command.type = blob_command_add;
+            command.value = {
+                v4(1.5f * glm::cos(angle), 0.5f, 1.0f + 1.5f * glm::sin(angle), 1.0f), v4(0.0f, 0.0f, 0.0f, 0.3f),
+                v4(0.0f, 0.0f, 0.0f, 1.0f), sdf_sphere, sdf_smooth_add
+            };
+            submit_blob_command(command);
+        }
+
+        ImGui::SameLine();
+        if (ImGui::Button("Delete last")) {
+            command.type = blob_command_delete_last;
+            submit_blob_command(command);
+        }
+
+        ImGui::SameLine();
+        if (ImGui::Button("Undo")) {
+            command.type = blob_command_undo;
+            submit_blob_command(command);
+        }
+    }
+    ImGui::Text("Uploads: %.2f KB / frame", (f32)p->upload_bytes / 1024.0f);
+    ImGui::Text("Device memory: %.1f / %.1f MB",
+        (f64)p->device_memory_bytes / (1024.0 * 1024.0),
+        (f64)p->device_local_heap_bytes / (1024.0 * 1024.0));
+
+    if (ImGui::CollapsingHeader("Host memory")) {
+        for (u32 i = 0; i < mem_category_count; ++i) {
+            const mem_category_stats &stats = get_mem_stats((mem_category)i);
+            ImGui::Text("%-10s %8.2f MB (peak %.2f MB, %llu allocations)",
+                get_mem_category_name((mem_category)i),
+                (f64)stats.bytes.load() / (1024.0 * 1024.0),
+                (f64)stats.peak_bytes.load() / (1024.0 * 1024.0),
+                (unsigned long long)stats.allocation_count.load());
+        }
+
+        const linear_allocator &frame_allocator = get_frame_allocator();
+        ImGui::Text("Frame scratch: %.1f / %.1f KB",
+            (f32)frame_allocator.used() / 1024.0f, (f32)frame_allocator.capacity() / 1024.0f);
+    }
+
+    if (ImGui::CollapsingHeader("March cost")) {
+        bool is_instrumented = ggfx->is_instrumented;
+        bool show_march_cost = ggfx->show_march_cost;
 
-#if 0
-    for (uint32_t i = 0; i < g_ctx->debug.ui_proc_count; ++i) {
-        (g_ctx->debug.ui_procs[i])();
+        ImGui::Checkbox("Instrument (F1)", &is_instrumented);
+        ImGui::Checkbox("Heatmap", &show_march_cost);
+
+        ggfx->is_instrumented = is_instrumented;
+        ggfx->show_march_cost = show_march_cost && is_instrumented;
+
+        if (is_instrumented) {
+            const march_cost_stats &stats = ggfx->march_stats;
+            f32 pixel_count = (f32)(gctx->swapchain_extent.width * gctx->swapchain_extent.height);
+
+            ImGui::Text("March steps:  %u (%.1f / px)", stats.march_steps, (f32)stats.march_steps / pixel_count);
+            ImGui::Text("Shadow steps: %u (%.1f / px)", stats.shadow_steps, (f32)stats.shadow_steps / pixel_count);
+            ImGui::Text("map() calls:  %u (%.1f / px)", stats.map_calls, (f32)stats.map_calls / pixel_count);
+            ImGui::Text("Hit pixels:   %u", stats.hit_pixels);
+        }
     }
-#endif
 
     ImGui::End();
+}
+
+void render_debug_overlay(render_graph &graph, texture &target, u32 image_idx) {
+    if (was_key_pressed(GLFW_KEY_F3)) {
+        is_visible_ = !is_visible_;
+    }
+
+    if (!is_visible_) {
+        return;
+    }
+
+    ImGui_ImplVulkan_NewFrame();
+    ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
+
+    render_performance_window_();
 
     ImGui::Render();
 
+    // Start a render pass on top of what the compute passes wrote
+    target.transition_layout(graph, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+
+    VkRenderPassBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    begin_info.renderPass = gctx->imgui_render_pass;
+    begin_info.framebuffer = framebuffers_[image_idx];
+    begin_info.renderArea.extent = gctx->swapchain_extent;
+    begin_info.clearValueCount = 0;
+
+    vkCmdBeginRenderPass(graph.cmdbuf(), &begin_info, VK_SUBPASS_CONTENTS_INLINE);
     ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), graph.cmdbuf());
+    vkCmdEndRenderPass(graph.cmdbuf());
 }
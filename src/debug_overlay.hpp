@@ -1,6 +1,8 @@
 #pragma once
 
+#include "texture.hpp"
 #include "render_graph.hpp"
 
 void init_debug_overlay();
-void render_debug_overlay(render_graph &graph);
+// F3 toggles the overlay
+void render_debug_overlay(render_graph &graph, texture &target, u32 image_idx);
@@ -0,0 +1,97 @@
+#include "compute.hpp"
+#include "core_render.hpp"
+
+/* Mip chain of distance bounds for empty space skipping in blob_cast
+ * (distance_pyramid.glsl): level 0 from the field, every other level as the
+ * min of the one below. Only holds the static blobs, so only gets rebuilt
+ * when those change, fitted to where they are. blob_cast keeps its skips
+ * clear of the dynamic blobs itself. */
+
+// Same as distance_pyramid.glsl
+static constexpr u32 pyramid_size_ = 32;
+static constexpr u32 level_count_ = 5;
+
+static constexpr u32 group_size_ = 4;
+static constexpr VkFormat format_ = VK_FORMAT_R32_SFLOAT;
+
+struct distance_pyramid_settings_ {
+    // xyz: low corner, w: size of a level 0 cell
+    v4 region;
+};
+
+static compute_pass base_pass_;
+static compute_pass reduce_pass_;
+
+// Nothing was built yet, or a CSG program kept the pyramid from following the edits
+static bool needs_build_;
+
+// Storage views of the single levels, the passes write through these
+static small_vector<texture, level_count_> level_views_;
+
+static u32 group_count_(u32 size) {
+    return (size + group_size_ - 1) / group_size_;
+}
+
+void init_distance_pyramid_pass() {
+    ggfx->distance_pyramid = make_storage_texture_3d(pyramid_size_, pyramid_size_, pyramid_size_, format_, level_count_);
+
+    for (u32 i = 0; i < level_count_; ++i) {
+        level_views_.emplace_back(make_texture_level_view(ggfx->distance_pyramid, i, VK_IMAGE_VIEW_TYPE_3D, format_));
+    }
+
+    base_pass_ = make_compute_pass<distance_pyramid_settings_>(
+        "distance_pyramid_base",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE }
+    );
+
+    reduce_pass_ = make_compute_pass<no_push_constant>(
+        "distance_pyramid_reduce",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE }
+    );
+
+    ggfx->is_distance_pyramid_ready = false;
+    needs_build_ = true;
+}
+
+// Runs after the LBVH, level 0 walks it
+void run_distance_pyramid_pass(render_graph &graph) {
+    // The BVH isn't built while a CSG program runs, blob_cast doesn't skip with the pyramid then anyway
+    if (ggfx->is_csg_program_active) {
+        needs_build_ = true;
+        ggfx->is_distance_pyramid_ready = false;
+        return;
+    }
+
+    if (!needs_build_ && !ggfx->blob_view->is_static_changed) {
+        return;
+    }
+
+    needs_build_ = false;
+
+    // Cubic cells over the longest side, the rays march as usual outside
+    const aabb &bounds = ggfx->blob_view->static_bounds;
+    v3 extent = bounds.max - bounds.min;
+    f32 cell_size = glm::max(extent.x, glm::max(extent.y, extent.z)) / pyramid_size_;
+
+    // Without static additions there's nothing to bound
+    ggfx->is_distance_pyramid_ready = cell_size > 0.0f;
+    if (!ggfx->is_distance_pyramid_ready) {
+        return;
+    }
+
+    ggfx->pyramid_region = v4(bounds.min, cell_size);
+
+    distance_pyramid_settings_ settings = { ggfx->pyramid_region };
+    base_pass_.bind_resources(graph, &settings, ggfx->blob_data, ggfx->blob_bvh, level_views_[0]);
+    base_pass_.run(graph, group_count_(pyramid_size_), group_count_(pyramid_size_), group_count_(pyramid_size_));
+
+    for (u32 i = 1; i < level_count_; ++i) {
+        u32 size = pyramid_size_ >> i;
+
+        reduce_pass_.bind_resources<no_push_constant>(graph, nullptr, level_views_[i - 1], level_views_[i]);
+        reduce_pass_.run(graph, group_count_(size), group_count_(size), group_count_(size));
+    }
+}
@@ -1,16 +1,25 @@
 #include "file.hpp"
 #include "log.hpp"
 
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 file::file(const std::string &path, u32 file_type_bits) 
 : path_(path), file_type_bits_(file_type_bits) {
-    file_stream_.open(path_, file_type_bits_);
+    file_stream_.open(path_, (std::ios_base::openmode)file_type_bits_);
     if (file_stream_) {
         file_stream_.seekg(0, file_stream_.end);
         size_ = file_stream_.tellg();
         file_stream_.seekg(0, file_stream_.beg);
     }
     else {
-        log_error("Failed to find file", path_.c_str());
+        log_error("Failed to find file %s", path_.c_str());
         panic_and_exit();
     }
 }
@@ -23,13 +32,378 @@ heap_array<u8> file::read_binary() {
 
 std::string file::read_text() {
     std::string output;
-    output.reserve(size_);
-
-    output.assign(std::istreambuf_iterator<char>(file_stream_), std::istreambuf_iterator<char>());
-
+    output.resize(size_);
+    file_stream_.read(&output[0], size_);
     return output;
 }
 
 void file::write(const void *buffer, u32 size) {
     file_stream_.write((char *)buffer, size);
 }
+
+mapped_file::mapped_file()
+: data_(nullptr), size_(0), is_open_(false) {
+#if defined(_WIN32)
+    file_handle_ = nullptr;
+    mapping_handle_ = nullptr;
+#endif
+}
+
+#if defined(_WIN32)
+
+mapped_file::mapped_file(const std::string &path, map_hint hint)
+: mapped_file() {
+    HANDLE file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        hint == map_hint_sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        log_error("Failed to open file %s", path.c_str());
+        return;
+    }
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(file_handle, &size);
+
+    file_handle_ = file_handle;
+    size_ = size.QuadPart;
+    is_open_ = true;
+
+    if (size_ == 0) {
+        return;
+    }
+
+    HANDLE mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping_handle) {
+        log_error("Failed to map file %s", path.c_str());
+        close_();
+        return;
+    }
+
+    mapping_handle_ = mapping_handle;
+    data_ = (const u8 *)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+}
+
+void mapped_file::advise(map_hint hint, u64 offset, u64 size) {
+    if (!data_ || offset >= size_ || hint != map_hint_will_need) {
+        return;
+    }
+
+    WIN32_MEMORY_RANGE_ENTRY range = {};
+    range.VirtualAddress = (void *)(data_ + offset);
+    range.NumberOfBytes = (SIZE_T)(size < size_ - offset ? size : size_ - offset);
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void mapped_file::close_() {
+    if (data_) {
+        UnmapViewOfFile(data_);
+    }
+
+    if (mapping_handle_) {
+        CloseHandle(mapping_handle_);
+    }
+
+    if (file_handle_) {
+        CloseHandle(file_handle_);
+    }
+
+    data_ = nullptr;
+    size_ = 0;
+    is_open_ = false;
+    file_handle_ = nullptr;
+    mapping_handle_ = nullptr;
+}
+
+#else
+
+static int convert_map_hint_(map_hint hint) {
+    switch (hint) {
+    case map_hint_sequential: return MADV_SEQUENTIAL;
+    case map_hint_random: return MADV_RANDOM;
+    case map_hint_will_need: return MADV_WILLNEED;
+    case map_hint_dont_need: return MADV_DONTNEED;
+    default: return MADV_NORMAL;
+    }
+}
+
+mapped_file::mapped_file(const std::string &path, map_hint hint)
+: mapped_file() {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        log_error("Failed to open file %s", path.c_str());
+        return;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        log_error("Failed to stat file %s", path.c_str());
+        ::close(fd);
+        return;
+    }
+
+    size_ = info.st_size;
+    is_open_ = true;
+
+    if (size_) {
+        void *ptr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (ptr == MAP_FAILED) {
+            log_error("Failed to map file %s", path.c_str());
+            size_ = 0;
+            is_open_ = false;
+        }
+        else {
+            data_ = (const u8 *)ptr;
+            advise(hint);
+        }
+    }
+
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+}
+
+void mapped_file::advise(map_hint hint, u64 offset, u64 size) {
+    if (!data_ || offset >= size_) {
+        return;
+    }
+
+    // madvise wants a page aligned start
+    u64 page_size = (u64)sysconf(_SC_PAGESIZE);
+    u64 begin = offset & ~(page_size - 1);
+    u64 end = size < size_ - offset ? offset + size : size_;
+
+    madvise((void *)(data_ + begin), end - begin, convert_map_hint_(hint));
+}
+
+void mapped_file::close_() {
+    if (data_) {
+        munmap((void *)data_, size_);
+    }
+
+    data_ = nullptr;
+    size_ = 0;
+    is_open_ = false;
+}
+
+#endif
+
+growable_mapped_file::growable_mapped_file()
+: data_(nullptr), size_(0), capacity_(0) {
+#if defined(_WIN32)
+    file_handle_ = nullptr;
+    mapping_handle_ = nullptr;
+#else
+    fd_ = -1;
+#endif
+}
+
+growable_mapped_file::~growable_mapped_file() {
+    if (is_open()) {
+        close();
+    }
+}
+
+#if defined(_WIN32)
+
+static bool map_view_(void *file_handle, u64 capacity, void **mapping_handle, u8 **data) {
+    *mapping_handle = CreateFileMappingA((HANDLE)file_handle, nullptr, PAGE_READWRITE,
+        (DWORD)(capacity >> 32), (DWORD)capacity, nullptr);
+
+    if (!*mapping_handle) {
+        return false;
+    }
+
+    *data = (u8 *)MapViewOfFile((HANDLE)*mapping_handle, FILE_MAP_WRITE, 0, 0, 0);
+    return *data != nullptr;
+}
+
+bool growable_mapped_file::open(const std::string &path, u64 initial_capacity) {
+    HANDLE file_handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 
+        nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        log_error("Failed to open file %s", path.c_str());
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(file_handle, &size);
+
+    file_handle_ = file_handle;
+    size_ = size.QuadPart;
+    capacity_ = size_ > initial_capacity ? size_ : initial_capacity;
+
+    // Mapping with a bigger size than the file extends it
+    if (!map_view_(file_handle_, capacity_, &mapping_handle_, &data_)) {
+        log_error("Failed to map file %s", path.c_str());
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void growable_mapped_file::close() {
+    if (data_) {
+        UnmapViewOfFile(data_);
+    }
+
+    if (mapping_handle_) {
+        CloseHandle(mapping_handle_);
+    }
+
+    if (file_handle_) {
+        LARGE_INTEGER end;
+        end.QuadPart = size_;
+        SetFilePointerEx(file_handle_, end, nullptr, FILE_BEGIN);
+        SetEndOfFile(file_handle_);
+        CloseHandle(file_handle_);
+    }
+
+    data_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+    file_handle_ = nullptr;
+    mapping_handle_ = nullptr;
+}
+
+bool growable_mapped_file::reserve(u64 capacity) {
+    if (capacity <= capacity_) {
+        return true;
+    }
+
+    UnmapViewOfFile(data_);
+    CloseHandle(mapping_handle_);
+
+    capacity_ = capacity;
+    if (!map_view_(file_handle_, capacity_, &mapping_handle_, &data_)) {
+        log_error("Failed to grow file mapping to %llu bytes", capacity);
+        return false;
+    }
+
+    return true;
+}
+
+void growable_mapped_file::flush(u64 offset, u64 size) {
+    FlushViewOfFile(data_ + offset, (SIZE_T)size);
+}
+
+bool file_exists(const std::string &path) {
+    return GetFileAttributesA(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+#else
+
+bool growable_mapped_file::open(const std::string &path, u64 initial_capacity) {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        log_error("Failed to open file %s", path.c_str());
+        return false;
+    }
+
+    struct stat info;
+    fstat(fd_, &info);
+
+    size_ = info.st_size;
+    capacity_ = 0;
+
+    if (!reserve(size_ > initial_capacity ? size_ : initial_capacity)) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void growable_mapped_file::close() {
+    if (data_) {
+        munmap(data_, capacity_);
+    }
+
+    if (fd_ >= 0) {
+        if (ftruncate(fd_, size_) < 0) {
+            log_warning("Failed to trim mapped file");
+        }
+
+        ::close(fd_);
+    }
+
+    data_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+    fd_ = -1;
+}
+
+bool growable_mapped_file::reserve(u64 capacity) {
+    if (capacity <= capacity_) {
+        return true;
+    }
+
+    if (ftruncate(fd_, capacity) < 0) {
+        log_error("Failed to grow mapped file to %llu bytes", capacity);
+        return false;
+    }
+
+    if (data_) {
+        munmap(data_, capacity_);
+    }
+
+    void *ptr = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (ptr == MAP_FAILED) {
+        log_error("Failed to map %llu bytes", capacity);
+        data_ = nullptr;
+        capacity_ = 0;
+        return false;
+    }
+
+    data_ = (u8 *)ptr;
+    capacity_ = capacity;
+
+    return true;
+}
+
+void growable_mapped_file::flush(u64 offset, u64 size) {
+    u64 page_size = (u64)sysconf(_SC_PAGESIZE);
+    u64 begin = offset & ~(page_size - 1);
+
+    msync(data_ + begin, offset + size - begin, MS_ASYNC);
+}
+
+bool file_exists(const std::string &path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0;
+}
+
+#endif
+
+mapped_file::~mapped_file() {
+    close_();
+}
+
+mapped_file::mapped_file(mapped_file &&other)
+: mapped_file() {
+    *this = std::move(other);
+}
+
+mapped_file &mapped_file::operator=(mapped_file &&other) {
+    if (this != &other) {
+        close_();
+
+        data_ = other.data_;
+        size_ = other.size_;
+        is_open_ = other.is_open_;
+
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.is_open_ = false;
+
+#if defined(_WIN32)
+        file_handle_ = other.file_handle_;
+        mapping_handle_ = other.mapping_handle_;
+        other.file_handle_ = nullptr;
+        other.mapping_handle_ = nullptr;
+#endif
+    }
+
+    return *this;
+}
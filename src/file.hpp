@@ -2,6 +2,7 @@
 
 #include <string>
 #include <fstream>
+#include <string_view>
 
 #include "types.hpp"
 #include "heap_array.hpp"
@@ -33,3 +34,117 @@ private:
     std::string path_;
     size_t size_;
 };
+
+// Access pattern hints, forwarded to madvise
+enum map_hint : u32 {
+    map_hint_normal,
+    map_hint_sequential,
+    map_hint_random,
+    // Start paging the range in now
+    map_hint_will_need,
+    // The range won't be touched again for a while
+    map_hint_dont_need
+};
+
+/* Read-only memory mapping of a whole file. Opening is constant time, pages
+ * only get read when they're touched, and the bytes are handed out directly
+ * (no copy into a heap_array). Views stay valid as long as the mapping does. */
+class mapped_file {
+public:
+    mapped_file();
+    mapped_file(const std::string &path, map_hint hint = map_hint_normal);
+    ~mapped_file();
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    mapped_file(mapped_file &&other);
+    mapped_file &operator=(mapped_file &&other);
+
+    bool is_open() const { return is_open_; }
+    u64 size() const { return size_; }
+
+    // buffer sizes are 32 bit, bigger files have to go through view()
+    buffer<const u8> bytes() const {
+        assert(size_ <= 0xffffffffull && "mapped_file::bytes on a file of 4 GB or more");
+        return buffer<const u8>(data_, (u32)size_);
+    }
+
+    std::string_view text() const {
+        return std::string_view((const char *)data_, size_);
+    }
+
+    // Typed view into the file, count is clamped to what the file holds
+    template <typename T>
+    buffer<const T> view(u64 offset, u32 count) const {
+        if (offset > size_) {
+            return buffer<const T>(nullptr, 0);
+        }
+
+        // The count stays 64 bit until it's been clamped to the requested one
+        u64 available = (size_ - offset) / sizeof(T);
+        u32 clamped = count < available ? count : (u32)available;
+        return buffer<const T>((const T *)(data_ + offset), clamped);
+    }
+
+    void advise(map_hint hint, u64 offset = 0, u64 size = ~0ull);
+
+private:
+    void close_();
+
+private:
+    const u8 *data_;
+    u64 size_;
+    bool is_open_;
+
+#if defined(_WIN32)
+    void *file_handle_;
+    void *mapping_handle_;
+#endif
+};
+
+/* Writable, shared mapping for append-only files (the edit journal). The
+ * file is extended ahead of the writes and trimmed back when closed. */
+class growable_mapped_file {
+public:
+    growable_mapped_file();
+    ~growable_mapped_file();
+
+    growable_mapped_file(const growable_mapped_file &) = delete;
+    growable_mapped_file &operator=(const growable_mapped_file &) = delete;
+
+    // Creates the file if it doesn't exist, size is what was in it before
+    bool open(const std::string &path, u64 initial_capacity);
+    // Trims the file down to size
+    void close();
+
+    bool is_open() const { return data_ != nullptr; }
+    u8 *data() { return data_; }
+    u64 size() const { return size_; }
+    u64 capacity() const { return capacity_; }
+
+    // Bytes in use, the rest of the capacity gets trimmed off on close
+    void set_size(u64 size) {
+        assert(size <= capacity_);
+        size_ = size;
+    }
+
+    // Extends the file and remaps it, pointers into the mapping are invalidated
+    bool reserve(u64 capacity);
+    // Starts writing the range back without waiting for it
+    void flush(u64 offset, u64 size);
+
+private:
+    u8 *data_;
+    u64 size_;
+    u64 capacity_;
+
+#if defined(_WIN32)
+    void *file_handle_;
+    void *mapping_handle_;
+#else
+    int fd_;
+#endif
+};
+
+bool file_exists(const std::string &path);
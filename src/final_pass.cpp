@@ -1,20 +1,211 @@
 #include "compute.hpp"
 #include "core_render.hpp"
+#include "scene_shader.hpp"
 
+#include <stddef.h>
+#include <iterator>
+
+// Shared with the shaders
+#include "../res/glsl/tile_layout.h"
+
+/* blob_cast only runs on the tiles which can hit a blob:
+ *
+ *   tile_classify    frustum of each 16x16 tile against the BVH (or the
+ *                    bounds of the CSG program), appends the tile to the
+ *                    hit or the empty list and counts it in the matching
+ *                    dispatch command. Hit tiles also get the list of
+ *                    blobs their rays need
+ *   tile_clear       indirect over the empty tiles, writes the background
+ *   blob_cast        indirect over the hit tiles, only evaluating the
+ *                    tile's blobs. Once the scene is quiet, a variant with
+ *                    the blobs inlined takes over (scene_shader.cpp)
+ *
+ * The group counts never come back to the CPU. The camera is fixed, so
+ * the tiles only change with the blobs. */
+
+// Same layout as the start of tile_work in tile.glsl
+struct tile_work_header_ {
+    VkDispatchIndirectCommand hit_dispatch;
+    u32 pad0;
+    VkDispatchIndirectCommand empty_dispatch;
+    u32 pad1;
+};
+
+// Same layout as tile_blobs in tile_blobs.glsl
+struct tile_blobs_ {
+    u32 cells[tile_cell_count];
+    u32 pool_count;
+    u32 pad[3];
+    u32 pool[tile_blob_pool_size];
+};
+
+static_assert(tile_blob_pool_size <= tile_size * tile_size, "blob_cast stages the pool with an invocation per entry");
+
+struct tile_classify_settings_ {
+    u32 width;
+    u32 height;
+    u32 use_csg_program;
+    u32 pad;
+    v4 csg_lo;
+    v4 csg_hi;
+};
+
+struct tile_clear_settings_ {
+    u32 clear_cost;
+};
+
+struct blob_cast_settings_ {
+    u32 use_bricks;
+    u32 use_distance_pyramid;
+    u32 use_occupancy;
+    u32 use_csg_program;
+    v4 pyramid_region;
+};
+
+static constexpr u32 classify_group_size_ = 64;
+
+static compute_pass classify_pass_;
+static compute_pass clear_pass_;
 static compute_pass final_pass_;
+// Same shader compiled with MIRAGE_INSTRUMENT, see march_cost_pass.cpp
+static compute_pass instrumented_pass_;
+
+// Whether tile_work and tile_blobs hold the current blobs
+static bool is_classified_ = false;
+
+// Resources of every blob_cast variant, the instrumented one has the last two on top
+static uprototype blob_cast_prototypes_[] = {
+    uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
+    uprototype{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER },
+    uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+    uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+    uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+    uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+    uprototype{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE },
+    uprototype{ VK_DESCRIPTOR_TYPE_SAMPLER },
+    uprototype{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE },
+    uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+    uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+    uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+    uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
+    uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+};
+
+// The cost image and counters only the instrumented variant binds
+static constexpr u32 instrumented_prototype_count_ = 2;
+static constexpr u32 blob_cast_prototype_count_ = (u32)std::size(blob_cast_prototypes_) - instrumented_prototype_count_;
+
+static u32 tile_count_() {
+    u32 tiles_x = (gctx->swapchain_extent.width + tile_size - 1) / tile_size;
+    u32 tiles_y = (gctx->swapchain_extent.height + tile_size - 1) / tile_size;
+    return tiles_x * tiles_y;
+}
 
 void init_final_pass() {
-    final_pass_ = make_compute_pass<no_push_constant>(
-        "blob_cast",
+    ggfx->tile_work = make_indirect_buffer(sizeof(tile_work_header_) + tile_count_() * sizeof(u32));
+    ggfx->tile_blobs = make_storage_buffer(tile_count_() * sizeof(tile_blobs_));
+
+    // Until tile_classify writes them every cell falls back to the BVH
+    tile_blobs_ *tiles = mem_allocv<tile_blobs_>(tile_count_());
+    for (u32 i = 0; i < tile_count_(); ++i) {
+        tiles[i] = {};
+        for (u32 cell = 0; cell < tile_cell_count; ++cell) {
+            tiles[i].cells[cell] = tile_blobs_unpruned;
+        }
+    }
+
+    upload_buffer_blocking(ggfx->tile_blobs, 0, tiles, tile_count_() * sizeof(tile_blobs_));
+    mem_freev(tiles);
+
+    classify_pass_ = make_compute_pass<tile_classify_settings_>(
+        "tile_classify",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+    );
+
+    clear_pass_ = make_compute_pass<tile_clear_settings_>(
+        "tile_clear",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
         uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
-        uprototype{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER },
-        uprototype{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER }
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
     );
+
+    buffer<uprototype> prototypes(blob_cast_prototypes_, blob_cast_prototype_count_);
+    final_pass_ = compute_pass("blob_cast", sizeof(blob_cast_settings_), prototypes);
+
+    // The instrumented variant also gets the cost image and counters
+    buffer<uprototype> instrumented_prototypes(blob_cast_prototypes_, (u32)std::size(blob_cast_prototypes_));
+    instrumented_pass_ = compute_pass("blob_cast_instrumented", sizeof(blob_cast_settings_), instrumented_prototypes);
+}
+
+compute_pass make_blob_cast_pass(buffer<const u32> spirv) {
+    buffer<uprototype> prototypes(blob_cast_prototypes_, blob_cast_prototype_count_);
+    return compute_pass(spirv, sizeof(blob_cast_settings_), prototypes);
+}
+
+static void run_tile_classify_(render_graph &graph, bool is_blob_data_changed) {
+    // Nothing changed since the tiles were classified, the lists still hold
+    if (is_classified_ && !is_blob_data_changed) {
+        return;
+    }
+
+    is_classified_ = true;
+
+    // Both lists start empty, tile_classify counts the groups up
+    tile_work_header_ header = {};
+    header.hit_dispatch = { 0, 1, 1 };
+    header.empty_dispatch = { 0, 1, 1 };
+    ggfx->tile_work.update(graph, 0, sizeof(header), &header);
+
+    tile_classify_settings_ settings = {
+        gctx->swapchain_extent.width, gctx->swapchain_extent.height, ggfx->is_csg_program_active, 0,
+        v4(ggfx->csg_lo, 0.0f), v4(ggfx->csg_hi, 0.0f)
+    };
+    classify_pass_.bind_resources(graph, &settings, ggfx->blob_bvh, ggfx->tile_work, ggfx->blob_data, ggfx->tile_blobs);
+    classify_pass_.run(graph, (tile_count_() + classify_group_size_ - 1) / classify_group_size_, 1, 1);
 }
 
-void run_final_pass(render_graph &graph, texture &target) {
-    final_pass_.bind_resources<no_push_constant>(graph, nullptr,
-        target, ggfx->time_uniform_data, ggfx->blob_data);
+void run_final_pass(render_graph &graph, texture &target, bool is_blob_data_changed) {
+    run_tile_classify_(graph, is_blob_data_changed);
+
+    tile_clear_settings_ clear_settings = { ggfx->is_instrumented };
+    clear_pass_.bind_resources(graph, &clear_settings, target, ggfx->march_cost_image, ggfx->tile_work);
+    clear_pass_.run_indirect(graph, ggfx->tile_work, offsetof(tile_work_header_, empty_dispatch));
+
+    // The caches all hold the fixed blob pattern, a CSG program runs without them
+    bool is_csg = ggfx->is_csg_program_active;
+
+    blob_cast_settings_ settings = {
+        !is_csg && ggfx->use_brick_map && ggfx->is_brick_map_ready,
+        !is_csg && ggfx->is_distance_pyramid_ready,
+        !is_csg && ggfx->is_occupancy_ready,
+        is_csg,
+        ggfx->pyramid_region
+    };
+
+    if (ggfx->is_instrumented) {
+        instrumented_pass_.bind_resources(graph, &settings,
+            target, ggfx->time_uniform_data, ggfx->blob_data, ggfx->blob_bvh, ggfx->tile_work,
+            ggfx->brick_grid, ggfx->brick_atlas, ggfx->linear_sampler, ggfx->distance_pyramid,
+            ggfx->occupancy_grid, ggfx->tile_blobs, ggfx->csg_program,
+            ggfx->march_cost_image, ggfx->march_cost_counters);
+
+        instrumented_pass_.run_indirect(graph, ggfx->tile_work, offsetof(tile_work_header_, hit_dispatch));
+    }
+    else {
+        // The scene's own field replaces map() entirely, the settings only matter for the skipping
+        compute_pass *pass = get_scene_shader_pass();
+        if (!pass) {
+            pass = &final_pass_;
+        }
+
+        pass->bind_resources(graph, &settings,
+            target, ggfx->time_uniform_data, ggfx->blob_data, ggfx->blob_bvh, ggfx->tile_work,
+            ggfx->brick_grid, ggfx->brick_atlas, ggfx->linear_sampler, ggfx->distance_pyramid,
+            ggfx->occupancy_grid, ggfx->tile_blobs, ggfx->csg_program);
 
-    final_pass_.run(graph, gctx->swapchain_extent.width / 16, gctx->swapchain_extent.height / 16, 1);
+        pass->run_indirect(graph, ggfx->tile_work, offsetof(tile_work_header_, hit_dispatch));
+    }
 }
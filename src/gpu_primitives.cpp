@@ -0,0 +1,438 @@
+#include "log.hpp"
+#include "memory.hpp"
+#include "compute.hpp"
+#include "gpu_primitives.hpp"
+#include "render_context.hpp"
+
+#include <algorithm>
+
+struct scan_settings_ {
+    u32 count;
+};
+
+struct compact_settings_ {
+    u32 count;
+    u32 tile_count;
+};
+
+struct reduce_settings_ {
+    u32 segment_count;
+};
+
+struct radix_histogram_settings_ {
+    u32 count;
+    u32 pass_count;
+};
+
+struct radix_pass_settings_ {
+    u32 count;
+    u32 pass;
+};
+
+static constexpr u32 group_size_ = 256;
+// Elements per workgroup of the single pass primitives (prim_scan.comp and friends)
+static constexpr u32 tile_size_ = group_size_ * 4;
+static constexpr u32 radix_bits_ = 8;
+static constexpr u32 radix_digit_count_ = 1 << radix_bits_;
+static constexpr u32 max_radix_passes_ = 4;
+// Segmented reduce spreads segments over rows of the dispatch
+static constexpr u32 max_groups_x_ = 65535;
+// Tile counter and padding in front of the status words (prim.glsl)
+static constexpr u32 status_header_size_ = 16;
+
+static compute_pass scan_pass_;
+static compute_pass compact_pass_;
+static compute_pass reduce_pass_;
+static compute_pass radix_histogram_pass_;
+static compute_pass radix_onesweep_pass_;
+
+static gpu_buffer status_;
+static gpu_buffer radix_histogram_;
+static u32 max_count_;
+
+static u32 tile_count_(u32 count) {
+    return (count + tile_size_ - 1) / tile_size_;
+}
+
+// Bytes of the status buffer a pass over count elements uses, with words_per_tile status words per tile
+static u32 status_size_(u32 count, u32 words_per_tile) {
+    return status_header_size_ + tile_count_(count) * words_per_tile * sizeof(u32);
+}
+
+static void make_status_(u32 max_count) {
+    max_count_ = max_count;
+
+    // The radix sort needs a status word per digit and tile, everything else one per tile
+    status_ = make_storage_buffer(status_size_(max_count, radix_digit_count_));
+}
+
+void init_gpu_primitives(u32 max_count) {
+    make_status_(max_count);
+    radix_histogram_ = make_storage_buffer(max_radix_passes_ * radix_digit_count_ * sizeof(u32));
+
+    scan_pass_ = make_compute_pass<scan_settings_>(
+        "prim_scan",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+    );
+
+    compact_pass_ = make_compute_pass<compact_settings_>(
+        "prim_compact",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+    );
+
+    reduce_pass_ = make_compute_pass<reduce_settings_>(
+        "prim_segmented_reduce",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+    );
+
+    radix_histogram_pass_ = make_compute_pass<radix_histogram_settings_>(
+        "prim_radix_histogram",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+    );
+
+    radix_onesweep_pass_ = make_compute_pass<radix_pass_settings_>(
+        "prim_radix_onesweep",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+    );
+}
+
+void gpu_exclusive_scan(render_graph &graph, gpu_buffer &in, gpu_buffer &out, u32 count) {
+    assert(count <= max_count_);
+    if (!count) {
+        return;
+    }
+
+    status_.clear(graph, 0, status_size_(count, 1));
+
+    scan_settings_ settings = { count };
+    scan_pass_.bind_resources(graph, &settings, in, out, status_);
+    scan_pass_.run(graph, tile_count_(count), 1, 1);
+}
+
+void gpu_compact(render_graph &graph, gpu_buffer &values, gpu_buffer &flags,
+    gpu_buffer &out, gpu_buffer &out_count, u32 count) {
+    assert(count <= max_count_);
+    if (!count) {
+        out_count.clear(graph);
+        return;
+    }
+
+    status_.clear(graph, 0, status_size_(count, 1));
+
+    compact_settings_ settings = { count, tile_count_(count) };
+    compact_pass_.bind_resources(graph, &settings, values, flags, out, out_count, status_);
+    compact_pass_.run(graph, settings.tile_count, 1, 1);
+}
+
+void gpu_segmented_reduce(render_graph &graph, gpu_buffer &values, gpu_buffer &offsets,
+    gpu_buffer &sums, u32 segment_count) {
+    if (!segment_count) {
+        return;
+    }
+
+    u32 groups_x = std::min(segment_count, max_groups_x_);
+    u32 groups_y = (segment_count + groups_x - 1) / groups_x;
+
+    reduce_settings_ settings = { segment_count };
+    reduce_pass_.bind_resources(graph, &settings, values, offsets, sums);
+    reduce_pass_.run(graph, groups_x, groups_y, 1);
+}
+
+void gpu_radix_sort(render_graph &graph, gpu_buffer &keys, gpu_buffer &values,
+    gpu_buffer &keys_tmp, gpu_buffer &values_tmp, u32 count, u32 key_bits) {
+    assert(count <= max_count_);
+    assert(key_bits <= max_radix_passes_ * radix_bits_);
+    if (!count) {
+        return;
+    }
+
+    u32 pass_count = (key_bits + radix_bits_ - 1) / radix_bits_;
+
+    radix_histogram_.clear(graph);
+
+    radix_histogram_settings_ histogram_settings = { count, pass_count };
+    radix_histogram_pass_.bind_resources(graph, &histogram_settings, keys, radix_histogram_);
+    radix_histogram_pass_.run(graph, tile_count_(count), 1, 1);
+
+    gpu_buffer *keys_in = &keys;
+    gpu_buffer *values_in = &values;
+    gpu_buffer *keys_out = &keys_tmp;
+    gpu_buffer *values_out = &values_tmp;
+
+    for (u32 pass = 0; pass < pass_count; ++pass) {
+        status_.clear(graph, 0, status_size_(count, radix_digit_count_));
+
+        radix_pass_settings_ settings = { count, pass };
+        radix_onesweep_pass_.bind_resources(graph, &settings,
+            *keys_in, *values_in, *keys_out, *values_out, radix_histogram_, status_);
+        radix_onesweep_pass_.run(graph, tile_count_(count), 1, 1);
+
+        std::swap(keys_in, keys_out);
+        std::swap(values_in, values_out);
+    }
+
+    // An odd number of passes leaves the result in the temporaries
+    if (keys_in != &keys) {
+        keys_tmp.copy_to(graph, keys);
+        values_tmp.copy_to(graph, values);
+    }
+}
+
+// Self test, see test_gpu_primitives
+struct test_queries_ {
+    VkQueryPool pool;
+    f32 period_ns;
+};
+
+template <typename F>
+static void submit_blocking_(F &&record) {
+    VkCommandBuffer command_buffer;
+    VkCommandBufferAllocateInfo command_buffer_info = {};
+    command_buffer_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_info.commandBufferCount = 1;
+    command_buffer_info.commandPool = gctx->command_pool;
+    command_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    vkAllocateCommandBuffers(gctx->device, &command_buffer_info, &command_buffer);
+
+    {
+        render_graph graph (command_buffer, render_graph::one_time);
+        record(graph);
+
+        graph.submit(gctx->graphics_queue, VK_NULL_HANDLE, VK_NULL_HANDLE,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_NULL_HANDLE);
+    }
+
+    vkQueueWaitIdle(gctx->graphics_queue);
+    vkFreeCommandBuffers(gctx->device, gctx->command_pool, 1, &command_buffer);
+}
+
+// Runs the primitive once to warm up, then again between two timestamps
+template <typename F>
+static f32 time_primitive_ms_(test_queries_ &queries, F &&record) {
+    submit_blocking_(record);
+
+    submit_blocking_([&queries, &record] (render_graph &graph) {
+        vkCmdResetQueryPool(graph.cmdbuf(), queries.pool, 0, 2);
+        vkCmdWriteTimestamp(graph.cmdbuf(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queries.pool, 0);
+        record(graph);
+        vkCmdWriteTimestamp(graph.cmdbuf(), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queries.pool, 1);
+    });
+
+    u64 timestamps[2];
+    vkGetQueryPoolResults(gctx->device, queries.pool, 0, 2, sizeof(timestamps), timestamps,
+        sizeof(u64), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+    return (f32)(timestamps[1] - timestamps[0]) * queries.period_ns / 1000000.0f;
+}
+
+static void read_back_(gpu_buffer &src, gpu_buffer &readback, u32 *dst, u32 count) {
+    submit_blocking_([&src, &readback] (render_graph &graph) {
+        src.copy_to(graph, readback);
+    });
+
+    memcpy(dst, readback.mapped(), count * sizeof(u32));
+}
+
+static bool report_(const char *name, bool is_correct, f32 ms, f64 bytes) {
+    f64 gb_per_s = bytes / ((f64)ms / 1000.0) / 1e9;
+
+    if (is_correct) {
+        log_info("%-16s ok, %.3f ms, %.1f GB/s", name, ms, gb_per_s);
+    }
+    else {
+        log_error("%-16s doesn't match the CPU reference", name);
+    }
+
+    return is_correct;
+}
+
+bool test_gpu_primitives() {
+    const u32 count = gpu_primitive_test_count;
+    const u32 segment_count = count / 1000;
+
+    // The frames only need scratch for the blobs, the test gets its own for the time it runs
+    u32 frame_max_count = max_count_;
+    if (count > max_count_) {
+        status_.destroy();
+        make_status_(count);
+    }
+
+    test_queries_ queries;
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(gctx->gpu, &properties);
+    queries.period_ns = properties.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    pool_info.queryCount = 2;
+    VK_CHECK(vkCreateQueryPool(gctx->device, &pool_info, nullptr, &queries.pool));
+
+    // Inputs, small values so the scan stays within 30 bits
+    heap_array<u32> values(count);
+    heap_array<u32> flags(count);
+    heap_array<u32> keys(count);
+    heap_array<u32> indices(count);
+    heap_array<u32> offsets(segment_count + 1);
+
+    u32 state = 0x9e3779b9;
+    for (u32 i = 0; i < count; ++i) {
+        state = state * 1664525u + 1013904223u;
+        values[i] = state >> 30;
+        flags[i] = (state >> 12) & 1;
+        keys[i] = state ^ (state >> 16);
+        indices[i] = i;
+    }
+
+    for (u32 i = 0; i <= segment_count; ++i) {
+        // Uneven segments, some of them empty
+        offsets[i] = std::min(count, (u32)(((u64)i * i * count) / ((u64)segment_count * segment_count)));
+    }
+    offsets[segment_count] = count;
+
+    u32 buffer_size = count * sizeof(u32);
+    gpu_buffer values_buffer = make_storage_buffer(buffer_size);
+    gpu_buffer flags_buffer = make_storage_buffer(buffer_size);
+    gpu_buffer keys_buffer = make_storage_buffer(buffer_size);
+    gpu_buffer indices_buffer = make_storage_buffer(buffer_size);
+    gpu_buffer offsets_buffer = make_storage_buffer((segment_count + 1) * sizeof(u32));
+    gpu_buffer out_buffer = make_storage_buffer(buffer_size);
+    gpu_buffer tmp_buffer = make_storage_buffer(buffer_size);
+    gpu_buffer count_buffer = make_storage_buffer(sizeof(u32));
+    gpu_buffer readback = make_readback_buffer(buffer_size);
+
+    upload_buffer_blocking(values_buffer, 0, values.data(), buffer_size);
+    upload_buffer_blocking(flags_buffer, 0, flags.data(), buffer_size);
+    upload_buffer_blocking(offsets_buffer, 0, offsets.data(), (segment_count + 1) * sizeof(u32));
+
+    heap_array<u32> result(count);
+    bool is_ok = true;
+
+    // Scan
+    {
+        f32 ms = time_primitive_ms_(queries, [&] (render_graph &graph) {
+            gpu_exclusive_scan(graph, values_buffer, out_buffer, count);
+        });
+
+        read_back_(out_buffer, readback, result.data(), count);
+
+        bool is_correct = true;
+        for (u32 i = 0, sum = 0; i < count && is_correct; sum += values[i], ++i) {
+            is_correct = result[i] == sum;
+        }
+
+        is_ok &= report_("scan", is_correct, ms, 2.0 * buffer_size);
+    }
+
+    // Compaction
+    {
+        f32 ms = time_primitive_ms_(queries, [&] (render_graph &graph) {
+            gpu_compact(graph, values_buffer, flags_buffer, out_buffer, count_buffer, count);
+        });
+
+        read_back_(out_buffer, readback, result.data(), count);
+        u32 kept = 0;
+        for (u32 i = 0; i < count; ++i) {
+            kept += flags[i] != 0;
+        }
+
+        bool is_correct = true;
+        for (u32 i = 0, dst = 0; i < count && is_correct; ++i) {
+            if (flags[i]) {
+                is_correct = result[dst++] == values[i];
+            }
+        }
+
+        u32 gpu_kept;
+        read_back_(count_buffer, readback, &gpu_kept, 1);
+        is_correct &= gpu_kept == kept;
+
+        is_ok &= report_("compact", is_correct, ms, 2.0 * buffer_size + kept * sizeof(u32));
+    }
+
+    // Segmented reduction
+    {
+        f32 ms = time_primitive_ms_(queries, [&] (render_graph &graph) {
+            gpu_segmented_reduce(graph, values_buffer, offsets_buffer, out_buffer, segment_count);
+        });
+
+        read_back_(out_buffer, readback, result.data(), segment_count);
+
+        bool is_correct = true;
+        for (u32 i = 0; i < segment_count && is_correct; ++i) {
+            u32 sum = 0;
+            for (u32 j = offsets[i]; j < offsets[i + 1]; ++j) {
+                sum += values[j];
+            }
+
+            is_correct = result[i] == sum;
+        }
+
+        is_ok &= report_("segmented reduce", is_correct, ms, (f64)buffer_size + (segment_count * 2 + 1) * sizeof(u32));
+    }
+
+    // Radix sort, the keys get uploaded again before the checked run since sorting is in place
+    {
+        upload_buffer_blocking(keys_buffer, 0, keys.data(), buffer_size);
+        upload_buffer_blocking(indices_buffer, 0, indices.data(), buffer_size);
+
+        f32 ms = time_primitive_ms_(queries, [&] (render_graph &graph) {
+            gpu_radix_sort(graph, keys_buffer, indices_buffer, out_buffer, tmp_buffer, count, 32);
+        });
+
+        upload_buffer_blocking(keys_buffer, 0, keys.data(), buffer_size);
+        upload_buffer_blocking(indices_buffer, 0, indices.data(), buffer_size);
+        submit_blocking_([&] (render_graph &graph) {
+            gpu_radix_sort(graph, keys_buffer, indices_buffer, out_buffer, tmp_buffer, count, 32);
+        });
+
+        heap_array<u32> sorted_indices(count);
+        read_back_(keys_buffer, readback, result.data(), count);
+        read_back_(indices_buffer, readback, sorted_indices.data(), count);
+
+        std::stable_sort(indices.begin(), indices.end(), [&keys] (u32 a, u32 b) {
+            return keys[a] < keys[b];
+        });
+
+        bool is_correct = true;
+        for (u32 i = 0; i < count && is_correct; ++i) {
+            is_correct = sorted_indices[i] == indices[i] && result[i] == keys[indices[i]];
+        }
+
+        // Every pass reads and writes keys and values, plus the histogram sweep
+        is_ok &= report_("radix sort", is_correct, ms, 4.0 * 4.0 * buffer_size + buffer_size);
+    }
+
+    vkDestroyQueryPool(gctx->device, queries.pool, nullptr);
+
+    values_buffer.destroy();
+    flags_buffer.destroy();
+    keys_buffer.destroy();
+    indices_buffer.destroy();
+    offsets_buffer.destroy();
+    out_buffer.destroy();
+    tmp_buffer.destroy();
+    count_buffer.destroy();
+    readback.destroy();
+
+    if (frame_max_count != max_count_) {
+        status_.destroy();
+        make_status_(frame_max_count);
+    }
+
+    return is_ok;
+}
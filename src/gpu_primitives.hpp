@@ -0,0 +1,32 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "render_graph.hpp"
+
+/* Building blocks for GPU side acceleration structures, all on uint
+ * elements (res/glsl/prim*). Buffers are plain storage buffers, counts come
+ * from the CPU. Scan and compaction sums have to stay below 2^30, that's
+ * what fits next to the flag of a lookback status word. */
+
+// Elements used by test_gpu_primitives
+constexpr u32 gpu_primitive_test_count = 1 << 22;
+
+// Scratch memory is sized for max_count elements, test_gpu_primitives grows it for itself
+void init_gpu_primitives(u32 max_count);
+
+// out[i] = in[0] + ... + in[i - 1]
+void gpu_exclusive_scan(render_graph &graph, gpu_buffer &in, gpu_buffer &out, u32 count);
+// Values with a non zero flag, in order, and how many there were
+void gpu_compact(render_graph &graph, gpu_buffer &values, gpu_buffer &flags,
+    gpu_buffer &out, gpu_buffer &out_count, u32 count);
+// sums[i] = sum of values[offsets[i]] .. values[offsets[i + 1] - 1], offsets has segment_count + 1 entries
+void gpu_segmented_reduce(render_graph &graph, gpu_buffer &values, gpu_buffer &offsets,
+    gpu_buffer &sums, u32 segment_count);
+// Stable sort by the lowest key_bits bits of the keys, the result ends up in
+// keys/values, the temporaries are ping-pong space of the same size
+void gpu_radix_sort(render_graph &graph, gpu_buffer &keys, gpu_buffer &values,
+    gpu_buffer &keys_tmp, gpu_buffer &values_tmp, u32 count, u32 key_bits);
+
+// Checks every primitive against a CPU reference and logs its throughput,
+// outside the frame loop. False if any result was wrong
+bool test_gpu_primitives();
@@ -5,19 +5,19 @@
 #include "types.hpp"
 #include <initializer_list>
 
+// Fixed size, move-only owning array. Elements are constructed exactly once,
+// in place, and destroyed when the array goes away
 template <typename T>
 class heap_array {
 public:
     // Construction
-    heap_array() 
+    heap_array()
     : buffer_(nullptr), count_(0) {
 
     }
 
-    heap_array(std::initializer_list<T> list) {
-        buffer_ = (T *)mem_allocv<T>(list.size());
-        count_ = list.size();
-
+    heap_array(std::initializer_list<T> list)
+    : buffer_(allocate_(list.size())), count_(list.size()) {
         u32 i = 0;
         for (auto &item : list) {
             new(&buffer_[i]) T(item);
@@ -25,64 +25,54 @@ public:
         }
     }
 
-    heap_array(const T *ptr, u32 size) {
-        buffer_ = (T *)mem_allocv<T>(size);
-        count_ = size;
-
-        for (int i = 0; i < size; ++i) {
-            buffer_[i] = ptr[i];
+    heap_array(const T *ptr, u32 size)
+    : buffer_(allocate_(size)), count_(size) {
+        for (u32 i = 0; i < size; ++i) {
+            new(&buffer_[i]) T(ptr[i]);
         }
     }
 
-    heap_array(u32 size) {
-        buffer_ = (T *)mem_allocv<T>(size);
-        count_ = size;
-    }
-
-    ~heap_array() {
-        mem_freev(buffer_);
-        count_ = 0;
+    // Trivial types (Vulkan handles, PODs) are left uninitialized, anything
+    // else gets its default constructor
+    explicit heap_array(u32 size)
+    : buffer_(allocate_(size)), count_(size) {
+        for (u32 i = 0; i < size; ++i) {
+            new(&buffer_[i]) T;
+        }
     }
 
-    heap_array<T> &operator=(const std::vector<T> &other) {
-        if (!buffer_) {
-            alloc(other.size());
+    heap_array(u32 size, const T &value)
+    : buffer_(allocate_(size)), count_(size) {
+        for (u32 i = 0; i < size; ++i) {
+            new(&buffer_[i]) T(value);
         }
+    }
 
-        assert(other.size() == count_);
-
-        for (int i = 0; i < count_; ++i) {
-            buffer_[i] = other[i];
-        }
+    heap_array(const heap_array<T> &) = delete;
+    heap_array<T> &operator=(const heap_array<T> &) = delete;
 
-        return *this;
+    heap_array(heap_array<T> &&other)
+    : buffer_(other.buffer_), count_(other.count_) {
+        other.buffer_ = nullptr;
+        other.count_ = 0;
     }
 
-    heap_array<T> &operator=(const heap_array<T> &other) {
-        if (!buffer_) {
-            alloc(other.size());
-        }
+    heap_array<T> &operator=(heap_array<T> &&other) {
+        if (this != &other) {
+            release_();
 
-        assert(other.size() == count_);
+            buffer_ = other.buffer_;
+            count_ = other.count_;
 
-        for (int i = 0; i < count_; ++i) {
-            buffer_[i] = other[i];
+            other.buffer_ = nullptr;
+            other.count_ = 0;
         }
 
         return *this;
     }
 
-    heap_array<T> &operator=(std::initializer_list<T> list) {
-        buffer_ = (T *)mem_allocv<T>(list.size());
-        count_ = list.size();
-
-        u32 i = 0;
-        for (auto &item : list) {
-            new(&buffer_[i]) T(item);
-            ++i;
-        }
-
-        return *this;
+    ~heap_array() {
+        release_();
     }
 
     // Helpers
@@ -94,10 +84,27 @@ public:
     T &operator[](u32 index) { return buffer_[index]; }
     const T &operator[](u32 index) const { return buffer_[index]; }
 
+    T *begin() { return buffer_; }
+    T *end() { return buffer_ + count_; }
+    const T *begin() const { return buffer_; }
+    const T *end() const { return buffer_ + count_; }
+
 private:
-    void alloc(u32 size) {
-        count_ = size;
-        buffer_ = mem_allocv<T>(count_);
+    static T *allocate_(u32 count) {
+        return count ? (T *)mem_alloc_raw(sizeof(T) * count, alignof(T)) : nullptr;
+    }
+
+    void release_() {
+        for (u32 i = 0; i < count_; ++i) {
+            buffer_[i].~T();
+        }
+
+        if (buffer_) {
+            mem_free_raw(buffer_, sizeof(T) * count_, alignof(T));
+        }
+
+        buffer_ = nullptr;
+        count_ = 0;
     }
 
 private:
@@ -115,7 +122,7 @@ struct buffer {
 
     }
 
-    buffer(const heap_array<T> &ha) 
+    buffer(const heap_array<T> &ha)
     : data(ha.data()), size(ha.size()){
 
     }
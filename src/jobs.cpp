@@ -0,0 +1,280 @@
+#include "log.hpp"
+#include "jobs.hpp"
+#include "memory.hpp"
+
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+struct job {
+    job_function function;
+    void *data;
+    u32 begin;
+    u32 end;
+    job_counter *counter;
+    // Where jobs kicked from inside this one get allocated
+    linear_allocator *allocator;
+};
+
+// Chase-Lev deque with a fixed capacity. The owner pushes and pops at the
+// bottom, thieves take from the top
+class job_deque {
+public:
+    static constexpr u32 capacity = 4096;
+
+    job_deque()
+    : top_(0), bottom_(0) {
+
+    }
+
+    bool push(job *j) {
+        s64 bottom = bottom_.load(std::memory_order_relaxed);
+        s64 top = top_.load(std::memory_order_acquire);
+
+        if (bottom - top >= (s64)capacity) {
+            return false;
+        }
+
+        jobs_[bottom & (capacity - 1)].store(j, std::memory_order_relaxed);
+        bottom_.store(bottom + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    job *pop() {
+        s64 bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        s64 top = top_.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            // Empty
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        job *j = jobs_[bottom & (capacity - 1)].load(std::memory_order_relaxed);
+
+        if (top == bottom) {
+            // Last one, race the thieves for it
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                j = nullptr;
+            }
+
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        return j;
+    }
+
+    job *steal() {
+        s64 top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        s64 bottom = bottom_.load(std::memory_order_acquire);
+
+        if (top >= bottom) {
+            return nullptr;
+        }
+
+        job *j = jobs_[top & (capacity - 1)].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+
+        return j;
+    }
+
+private:
+    // Owner and thieves on separate cache lines
+    alignas(64) std::atomic<s64> top_;
+    alignas(64) std::atomic<s64> bottom_;
+    std::atomic<job *> jobs_[capacity];
+};
+
+// Deques for threads which aren't workers but kick jobs, see attach_job_thread
+static constexpr u32 max_attached_threads_ = 2;
+static linear_allocator attached_allocators_[max_attached_threads_];
+
+static u32 thread_count_ = 1;
+static u32 deque_count_ = 1;
+static std::atomic<u32> attached_count_;
+static job_deque *deques_;
+static std::thread *workers_;
+static std::atomic<bool> is_running_;
+
+// Idle workers sleep until something gets pushed
+static std::mutex sleep_mutex_;
+static std::condition_variable sleep_condition_;
+static std::atomic<u32> queued_count_;
+static std::atomic<u32> sleeping_count_;
+
+static thread_local u32 worker_idx_ = 0;
+static thread_local u32 steal_seed_ = 0;
+// Null means the frame allocator
+static thread_local linear_allocator *job_allocator_ = nullptr;
+
+static void run_job_(job *j) {
+    linear_allocator *previous = job_allocator_;
+    job_allocator_ = j->allocator;
+
+    j->function(j->data, j->begin, j->end);
+    j->counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+
+    job_allocator_ = previous;
+}
+
+static job *find_job_() {
+    job *j = deques_[worker_idx_].pop();
+
+    if (!j) {
+        // Start at a random victim so thieves don't all hammer the same deque
+        steal_seed_ = steal_seed_ * 1664525u + 1013904223u;
+        u32 start = steal_seed_ % deque_count_;
+
+        for (u32 i = 0; i < deque_count_ && !j; ++i) {
+            u32 victim = (start + i) % deque_count_;
+            if (victim != worker_idx_) {
+                j = deques_[victim].steal();
+            }
+        }
+    }
+
+    if (j) {
+        queued_count_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    return j;
+}
+
+static void worker_proc_(u32 idx) {
+    worker_idx_ = idx;
+    steal_seed_ = idx * 2654435761u;
+
+    while (is_running_.load(std::memory_order_acquire)) {
+        job *j = find_job_();
+
+        if (j) {
+            run_job_(j);
+            continue;
+        }
+
+        // Spin a little before going to sleep, jobs tend to come in bursts
+        bool has_work = false;
+        for (u32 i = 0; i < 64 && !has_work; ++i) {
+            std::this_thread::yield();
+            has_work = queued_count_.load(std::memory_order_relaxed) != 0;
+        }
+
+        if (!has_work) {
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            sleeping_count_.fetch_add(1);
+            sleep_condition_.wait(lock, [] {
+                return queued_count_.load() != 0 || !is_running_.load();
+            });
+            sleeping_count_.fetch_sub(1);
+        }
+    }
+}
+
+void init_jobs(u32 worker_count) {
+    if (worker_count == 0) {
+        u32 core_count = std::thread::hardware_concurrency();
+        worker_count = core_count > 1 ? core_count - 1 : 0;
+    }
+
+    thread_count_ = worker_count + 1;
+    deque_count_ = thread_count_ + max_attached_threads_;
+    deques_ = mem_allocv<job_deque>(deque_count_);
+    workers_ = mem_allocv<std::thread>(worker_count);
+
+    is_running_.store(true, std::memory_order_release);
+
+    for (u32 i = 0; i < worker_count; ++i) {
+        workers_[i] = std::thread(&worker_proc_, i + 1);
+    }
+
+    log_info("Job system running on %u threads", thread_count_);
+}
+
+void shutdown_jobs() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        is_running_.store(false, std::memory_order_release);
+    }
+
+    sleep_condition_.notify_all();
+
+    for (u32 i = 0; i < thread_count_ - 1; ++i) {
+        workers_[i].join();
+    }
+
+    mem_freev(workers_);
+    mem_freev(deques_);
+    thread_count_ = 1;
+    deque_count_ = 1;
+    attached_count_.store(0);
+}
+
+u32 get_job_thread_count() {
+    return thread_count_;
+}
+
+void attach_job_thread(u32 allocator_capacity) {
+    u32 idx = attached_count_.fetch_add(1);
+    assert(idx < max_attached_threads_);
+
+    worker_idx_ = thread_count_ + idx;
+    steal_seed_ = worker_idx_ * 2654435761u;
+
+    if (!attached_allocators_[idx].capacity()) {
+        attached_allocators_[idx].init(allocator_capacity, mem_category_frame);
+    }
+    job_allocator_ = &attached_allocators_[idx];
+}
+
+void reset_attached_job_allocator() {
+    assert(job_allocator_);
+    job_allocator_->reset();
+}
+
+void kick_job(job_function function, void *data, u32 begin, u32 end, job_counter *counter) {
+    linear_allocator *allocator = job_allocator_ ? job_allocator_ : &get_frame_allocator();
+
+    job *j = (job *)allocator->allocate(sizeof(job), alignof(job));
+    j->function = function;
+    j->data = data;
+    j->begin = begin;
+    j->end = end;
+    j->counter = counter;
+    j->allocator = job_allocator_;
+
+    counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+    if (!deques_[worker_idx_].push(j)) {
+        // Deque is full, no point in queueing more
+        run_job_(j);
+        return;
+    }
+
+    // Both sides use sequentially consistent operations: either the pusher
+    // sees the sleeper, or the sleeper sees the queued job before waiting
+    queued_count_.fetch_add(1);
+
+    if (sleeping_count_.load() != 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        sleep_condition_.notify_one();
+    }
+}
+
+void wait_for_counter(job_counter *counter) {
+    while (counter->pending.load(std::memory_order_acquire) != 0) {
+        job *j = find_job_();
+
+        if (j) {
+            run_job_(j);
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <type_traits>
+
+#include "types.hpp"
+
+/* Work-stealing job system. Every thread (the main thread is worker 0) owns
+ * a Chase-Lev deque: it pushes and pops its own jobs from the bottom while
+ * idle workers steal from the top. Jobs live in the frame allocator, so they
+ * have to be finished (waited on) before the frame is over. Jobs kicked by an
+ * attached thread (and by the jobs it kicked) live in that thread's own
+ * allocator instead.
+ *
+ * Waiting never blocks: wait_for_counter runs other jobs until the counter
+ * it waits on drops to zero. */
+
+using job_function = void (*)(void *data, u32 begin, u32 end);
+
+// Number of jobs still in flight, one counter can track any number of them
+struct job_counter {
+    std::atomic<u32> pending { 0 };
+};
+
+// 0 workers means one per core, minus the main thread
+void init_jobs(u32 worker_count = 0);
+void shutdown_jobs();
+
+// Threads which run jobs, including the main thread
+u32 get_job_thread_count();
+
+// Gives a long running thread (the simulation) its own deque and job
+// allocator so it can kick jobs too. It only helps out with other jobs while
+// it waits on a counter
+void attach_job_thread(u32 allocator_capacity);
+// For the attached thread, once every job it kicked is done
+void reset_attached_job_allocator();
+
+// Can only be called from the main thread, an attached thread or from inside a job
+void kick_job(job_function function, void *data, u32 begin, u32 end, job_counter *counter);
+void wait_for_counter(job_counter *counter);
+
+template <typename F>
+void parallel_for_trampoline_(void *data, u32 begin, u32 end) {
+    (*(F *)data)(begin, end);
+}
+
+/* Calls body(begin, end) over [0, count) split into chunks. The chunk size
+ * targets a few chunks per thread so stealing can even out uneven work, but
+ * never goes below min_chunk so small loops don't drown in overhead. */
+template <typename F>
+void parallel_for(u32 count, F &&body, u32 min_chunk = 256) {
+    u32 thread_count = get_job_thread_count();
+
+    if (count <= min_chunk || thread_count == 1) {
+        body(0, count);
+        return;
+    }
+
+    u32 chunk = count / (thread_count * 4);
+    if (chunk < min_chunk) {
+        chunk = min_chunk;
+    }
+
+    using body_type = typename std::remove_reference<F>::type;
+
+    job_counter counter;
+    for (u32 begin = chunk; begin < count; begin += chunk) {
+        u32 end = begin + chunk < count ? begin + chunk : count;
+        kick_job(&parallel_for_trampoline_<body_type>, (void *)&body, begin, end, &counter);
+    }
+
+    // The first chunk runs right here
+    body(0, chunk);
+
+    wait_for_counter(&counter);
+}
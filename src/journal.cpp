@@ -0,0 +1,258 @@
+#include "log.hpp"
+#include "file.hpp"
+#include "scene.hpp"
+#include "memory.hpp"
+#include "journal.hpp"
+
+#include <thread>
+#include <atomic>
+#include <stdio.h>
+
+// Compact once this many records piled up
+static constexpr u64 compaction_threshold_ = 4096;
+static constexpr u64 initial_capacity_ = sizeof(journal_header) + 1024 * sizeof(blob_edit);
+
+static growable_mapped_file journal_file_;
+static std::string scene_path_;
+static journal_stats stats_;
+
+// Background compaction: a snapshot of the blobs gets written to the scene file
+static std::thread compaction_thread_;
+static std::atomic<bool> is_compaction_done_;
+static blob *snapshot_;
+static u32 snapshot_count_;
+static u32 snapshot_add_count_;
+static csg_node *snapshot_csg_;
+static u32 snapshot_csg_count_;
+static bool is_scene_replaced_;
+// Records which are part of the snapshot
+static u64 snapshot_record_count_;
+
+static journal_header *get_header_() {
+    return (journal_header *)journal_file_.data();
+}
+
+static blob_edit *get_records_() {
+    return (blob_edit *)(journal_file_.data() + sizeof(journal_header));
+}
+
+// The records have to be in place before they get counted, the file keeps as many as the header says
+static void set_record_count_(u64 record_count) {
+    std::atomic_thread_fence(std::memory_order_release);
+    get_header_()->record_count = record_count;
+    journal_file_.set_size(sizeof(journal_header) + record_count * sizeof(blob_edit));
+}
+
+static void reset_header_(u32 base_count, u32 base_add_count, u64 base_hash) {
+    journal_header *header = get_header_();
+    header->magic = journal_magic;
+    header->version = journal_version;
+    header->base_count = base_count;
+    header->base_add_count = base_add_count;
+    header->base_hash = base_hash;
+    header->next_record_count = 0;
+    set_record_count_(0);
+}
+
+// Moves the journal onto the scene a compaction wrote, its records are part of that scene now
+static void rebase_header_() {
+    journal_header *header = get_header_();
+    u64 remaining = header->record_count - header->next_record_count;
+
+    memmove(get_records_(), get_records_() + header->next_record_count, remaining * sizeof(blob_edit));
+    header->base_count = header->next_base_count;
+    header->base_add_count = header->next_base_add_count;
+    header->base_hash = header->next_base_hash;
+    header->next_record_count = 0;
+    set_record_count_(remaining);
+
+    journal_file_.flush(0, sizeof(journal_header) + remaining * sizeof(blob_edit));
+}
+
+static bool is_next_base_(const journal_header *header, u32 base_count, u32 base_add_count, u64 base_hash) {
+    return header->next_record_count && header->next_record_count <= header->record_count &&
+        header->next_base_count == base_count && header->next_base_add_count == base_add_count &&
+        header->next_base_hash == base_hash;
+}
+
+buffer<const blob_edit> open_journal(const std::string &scene_path, u32 base_count, u32 base_add_count, u64 base_hash) {
+    scene_path_ = scene_path;
+    std::string path = scene_path + ".journal";
+
+    if (!journal_file_.open(path, initial_capacity_)) {
+        log_warning("Edits won't be journaled");
+        return buffer<const blob_edit>(nullptr, 0);
+    }
+
+    journal_header *header = get_header_();
+
+    if (journal_file_.size() < sizeof(journal_header)) {
+        reset_header_(base_count, base_add_count, base_hash);
+    }
+    else if (header->magic != journal_magic || header->version != journal_version ||
+        sizeof(journal_header) + header->record_count * sizeof(blob_edit) > journal_file_.size()) {
+        log_warning("Journal %s is damaged, discarding it", path.c_str());
+        reset_header_(base_count, base_add_count, base_hash);
+    }
+    else if (is_next_base_(header, base_count, base_add_count, base_hash)) {
+        // A compaction replaced the scene but didn't get to rebase the journal
+        log_info("Finishing the compaction of %s", path.c_str());
+        rebase_header_();
+    }
+    else if (header->base_count != base_count || header->base_add_count != base_add_count || header->base_hash != base_hash) {
+        log_warning("Journal %s doesn't belong to this scene, discarding it", path.c_str());
+        reset_header_(base_count, base_add_count, base_hash);
+    }
+    else {
+        // Drops whatever an unclean exit left past the last record, and a
+        // compaction which never got to replace the scene
+        header->next_record_count = 0;
+        set_record_count_(header->record_count);
+    }
+
+    stats_.record_count = header->record_count;
+
+    if (header->record_count) {
+        log_info("Replaying %llu edits from %s", header->record_count, path.c_str());
+    }
+
+    return buffer<const blob_edit>(get_records_(), (u32)header->record_count);
+}
+
+void append_journal(const blob_edit &edit) {
+    if (!journal_file_.is_open()) {
+        return;
+    }
+
+    u64 count = get_header_()->record_count;
+    u64 end = sizeof(journal_header) + (count + 1) * sizeof(blob_edit);
+
+    if (end > journal_file_.capacity() && !journal_file_.reserve(journal_file_.capacity() * 2)) {
+        return;
+    }
+
+    get_records_()[count] = edit;
+    set_record_count_(count + 1);
+
+    journal_file_.flush(end - sizeof(blob_edit), sizeof(blob_edit));
+    stats_.record_count = count + 1;
+}
+
+static void compaction_thread_proc_() {
+    std::string tmp_path = scene_path_ + ".tmp";
+    save_scene(tmp_path, snapshot_, snapshot_count_, snapshot_add_count_, snapshot_csg_, snapshot_csg_count_);
+
+    // Readers either see the old scene or the new one
+    is_scene_replaced_ = rename(tmp_path.c_str(), scene_path_.c_str()) == 0;
+    if (!is_scene_replaced_) {
+        log_error("Failed to replace %s with the compacted scene", scene_path_.c_str());
+    }
+
+    is_compaction_done_.store(true, std::memory_order_release);
+}
+
+static void finish_compaction_() {
+    compaction_thread_.join();
+    mem_freev(snapshot_);
+    snapshot_ = nullptr;
+
+    if (snapshot_csg_) {
+        mem_freev(snapshot_csg_);
+        snapshot_csg_ = nullptr;
+    }
+
+    // Records which came in while the scene was written now apply to the new scene
+    if (is_scene_replaced_) {
+        rebase_header_();
+    }
+    else {
+        get_header_()->next_record_count = 0;
+    }
+
+    stats_.record_count = get_header_()->record_count;
+    ++stats_.compaction_count;
+    stats_.is_compacting = false;
+}
+
+bool update_journal() {
+    if (!journal_file_.is_open()) {
+        return false;
+    }
+
+    if (stats_.is_compacting) {
+        if (is_compaction_done_.load(std::memory_order_acquire)) {
+            finish_compaction_();
+        }
+
+        return false;
+    }
+
+    return get_header_()->record_count >= compaction_threshold_;
+}
+
+void start_journal_compaction(blob *packed, u32 count, u32 add_count, csg_node *csg_nodes, u32 csg_node_count) {
+    // Packing is the only part which has to happen on the caller's side, the scene keeps changing meanwhile
+    snapshot_ = packed;
+    snapshot_count_ = count;
+    snapshot_add_count_ = add_count;
+    snapshot_csg_ = csg_nodes;
+    snapshot_csg_count_ = csg_node_count;
+    snapshot_record_count_ = get_header_()->record_count;
+
+    // The journal has to know about the new scene before it can show up. That
+    // happens here since appends may remap the file under the compaction thread
+    journal_header *header = get_header_();
+    header->next_base_count = count;
+    header->next_base_add_count = add_count;
+    header->next_base_hash = hash_scene(packed, count, add_count, csg_nodes, csg_node_count);
+    header->next_record_count = snapshot_record_count_;
+    journal_file_.flush(0, sizeof(journal_header));
+
+    stats_.is_compacting = true;
+    is_compaction_done_.store(false, std::memory_order_relaxed);
+    compaction_thread_ = std::thread(&compaction_thread_proc_);
+}
+
+void save_journal_scene(const blob *packed, u32 count, u32 add_count, const csg_node *csg_nodes, u32 csg_node_count) {
+    if (!journal_file_.is_open()) {
+        save_scene(scene_path_, packed, count, add_count, csg_nodes, csg_node_count);
+        return;
+    }
+
+    if (stats_.is_compacting) {
+        finish_compaction_();
+    }
+
+    // Dying in between leaves a journal whose hash doesn't match the new scene, so it gets discarded instead of replayed twice
+    save_scene(scene_path_, packed, count, add_count, csg_nodes, csg_node_count);
+    reset_header_(count, add_count, hash_scene(packed, count, add_count, csg_nodes, csg_node_count));
+    journal_file_.flush(0, sizeof(journal_header));
+
+    stats_.record_count = 0;
+}
+
+void cut_journal(u64 record_count) {
+    if (!journal_file_.is_open() || record_count >= get_header_()->record_count) {
+        return;
+    }
+
+    set_record_count_(record_count);
+    journal_file_.flush(0, sizeof(journal_header));
+    stats_.record_count = record_count;
+}
+
+void close_journal() {
+    if (!journal_file_.is_open()) {
+        return;
+    }
+
+    if (stats_.is_compacting) {
+        finish_compaction_();
+    }
+
+    journal_file_.close();
+}
+
+const journal_stats &get_journal_stats() {
+    return stats_;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+
+#include "blob.hpp"
+#include "types.hpp"
+#include "heap_array.hpp"
+
+/* Append-only edit journal (<scene>.journal), memory mapped and little-endian
+ * like scene files:
+ *
+ *   journal_header
+ *   blob_edit[record_count]
+ *
+ * Every edit gets appended before record_count is bumped, so a crash loses at
+ * most the edit being written. Once the journal gets long, the scene with all
+ * edits applied is written out on a background thread and the journal gets
+ * cut down to the records which came in meanwhile. Saving the scene starts
+ * the journal over. */
+
+// "MJRN"
+constexpr u32 journal_magic = 0x4e524a4d;
+constexpr u32 journal_version = 4;
+
+struct journal_header {
+    u32 magic;
+    u32 version;
+    // Scene the records apply to (hash_scene), a journal for another scene gets discarded
+    u32 base_count;
+    u32 base_add_count;
+    u64 record_count;
+    u64 base_hash;
+    // Scene a running compaction is replacing the scene file with and how many
+    // of the records it has, so they can be dropped when a crash comes between
+    // the replacement and the rebase. next_record_count is 0 when none runs
+    u32 next_base_count;
+    u32 next_base_add_count;
+    u64 next_record_count;
+    u64 next_base_hash;
+    u64 pad;
+};
+
+static_assert(sizeof(journal_header) == 64, "journal_header is part of the file format");
+
+struct journal_stats {
+    u64 record_count;
+    u64 compaction_count;
+    u32 is_compacting : 1;
+};
+
+// Returns the records which have to be replayed on top of the scene
+buffer<const blob_edit> open_journal(const std::string &scene_path, u32 base_count, u32 base_add_count, u64 base_hash);
+void append_journal(const blob_edit &edit);
+// Finishes a running compaction, true when the journal has grown enough for a new one
+bool update_journal();
+// Writes the packed blobs and CSG tree (from mem_allocv or nullptr, ownership
+// moves to the journal) to the scene file
+void start_journal_compaction(blob *packed, u32 count, u32 add_count, csg_node *csg_nodes, u32 csg_node_count);
+// Writes the scene file right away and empties the journal, the scene has all
+// the edits now. Waits for a running compaction so it can't replace the file
+void save_journal_scene(const blob *packed, u32 count, u32 add_count, const csg_node *csg_nodes, u32 csg_node_count);
+// Drops the records from record_count on, replay didn't get past them
+void cut_journal(u64 record_count);
+// Waits for a running compaction
+void close_journal();
+
+const journal_stats &get_journal_stats();
@@ -0,0 +1,155 @@
+#include "compute.hpp"
+#include "core_render.hpp"
+#include "gpu_primitives.hpp"
+
+/* Linear BVH over the blobs, built on the GPU (lbvh.glsl has the node layout):
+ *
+ *   lbvh_bounds      scene bounds of the blob centers
+ *   lbvh_morton      30 bit Morton code per blob
+ *   gpu_radix_sort   on the codes, the blob indices go along
+ *   lbvh_hierarchy   Karras' construction, one thread per internal node
+ *   lbvh_refit       bounds from the leaves up to the root
+ *
+ * Only a change to the static blobs (or the count) builds it again, when
+ * only dynamic blobs moved the leaves stay where they are and lbvh_refit
+ * alone catches the bounds up. A CSG program doesn't walk it at all. */
+
+// Same layout as the start of blob_bvh in lbvh.glsl
+struct bvh_header_ {
+    u32 node_count;
+    u32 leaf_offset;
+    u32 pad[2];
+    // Ordered float bits, see order_float
+    u32 scene_lo[4];
+    u32 scene_hi[4];
+};
+
+struct bvh_node_ {
+    v3 lo;
+    u32 mask;
+    v3 hi;
+    u32 parent;
+    u32 left;
+    u32 right;
+    u32 visits;
+    u32 pad;
+};
+
+static_assert(sizeof(bvh_node_) == 48, "bvh_node_ has to match lbvh.glsl");
+
+struct lbvh_settings_ {
+    u32 count;
+};
+
+static constexpr u32 group_size_ = 256;
+static constexpr u32 morton_bits_ = 30;
+
+static compute_pass bounds_pass_;
+static compute_pass morton_pass_;
+static compute_pass hierarchy_pass_;
+static compute_pass refit_pass_;
+
+static gpu_buffer keys_[2];
+static gpu_buffer values_[2];
+
+// Whether the tree was built for the blobs in blob_data, so that refitting it will do
+static bool is_built_;
+
+static u32 group_count_(u32 count) {
+    return (count + group_size_ - 1) / group_size_;
+}
+
+void init_lbvh_pass() {
+    // The blob buffer never grows, neither does the tree
+    u32 capacity = ggfx->blobs->capacity;
+
+    ggfx->blob_bvh = make_storage_buffer(sizeof(bvh_header_) + 2 * capacity * sizeof(bvh_node_));
+
+    for (u32 i = 0; i < 2; ++i) {
+        keys_[i] = make_storage_buffer(capacity * sizeof(u32));
+        values_[i] = make_storage_buffer(capacity * sizeof(u32));
+    }
+
+    bounds_pass_ = make_compute_pass<no_push_constant>(
+        "lbvh_bounds",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+    );
+
+    morton_pass_ = make_compute_pass<no_push_constant>(
+        "lbvh_morton",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+    );
+
+    hierarchy_pass_ = make_compute_pass<lbvh_settings_>(
+        "lbvh_hierarchy",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+    );
+
+    refit_pass_ = make_compute_pass<no_push_constant>(
+        "lbvh_refit",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+    );
+}
+
+static void run_refit_(render_graph &graph, u32 count) {
+    refit_pass_.bind_resources<no_push_constant>(graph, nullptr, ggfx->blob_data, ggfx->blob_bvh);
+    refit_pass_.run(graph, group_count_(count), 1, 1);
+}
+
+void run_lbvh_pass(render_graph &graph) {
+    // tile_classify culls against the program's bounds and nothing else walks the tree then
+    if (ggfx->is_csg_program_active) {
+        is_built_ = false;
+        return;
+    }
+
+    u32 count = ggfx->blob_view->header.count;
+
+    if (is_built_ && !ggfx->blob_view->is_static_changed) {
+        if (count) {
+            run_refit_(graph, count);
+        }
+
+        return;
+    }
+
+    is_built_ = true;
+
+    bvh_header_ header = {};
+    header.node_count = count ? 2 * count - 1 : 0;
+    header.leaf_offset = count ? count - 1 : 0;
+    for (u32 i = 0; i < 4; ++i) {
+        // Empty bounds, lbvh_bounds grows them
+        header.scene_lo[i] = 0xffffffff;
+        header.scene_hi[i] = 0;
+    }
+
+    ggfx->blob_bvh.update(graph, 0, sizeof(bvh_header_), &header);
+
+    if (!count) {
+        return;
+    }
+
+    u32 group_count = group_count_(count);
+
+    bounds_pass_.bind_resources<no_push_constant>(graph, nullptr, ggfx->blob_data, ggfx->blob_bvh);
+    bounds_pass_.run(graph, group_count, 1, 1);
+
+    morton_pass_.bind_resources<no_push_constant>(graph, nullptr, ggfx->blob_data, ggfx->blob_bvh, keys_[0], values_[0]);
+    morton_pass_.run(graph, group_count, 1, 1);
+
+    gpu_radix_sort(graph, keys_[0], values_[0], keys_[1], values_[1], count, morton_bits_);
+
+    lbvh_settings_ settings = { count };
+    hierarchy_pass_.bind_resources(graph, &settings, keys_[0], values_[0], ggfx->blob_bvh);
+    hierarchy_pass_.run(graph, group_count, 1, 1);
+
+    run_refit_(graph, count);
+}
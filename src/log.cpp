@@ -0,0 +1,366 @@
+#include "log.hpp"
+#include "mpsc_ring.hpp"
+
+#include <chrono>
+#include <thread>
+
+struct log_record {
+    log_severity severity;
+    u64 key;
+    const char *format;
+    log_payload payload;
+};
+
+static constexpr u32 log_record_count_ = 1024;
+
+static mpsc_ring<log_record, log_record_count_> ring_;
+static std::atomic<u64> dropped_count_;
+
+static std::thread thread_;
+static std::atomic<bool> is_running_;
+static std::atomic<bool> is_initialized_;
+
+static std::atomic<u32> enabled_severities_ { (1 << log_severity_count) - 1 };
+static std::atomic<u32> rate_limit_ { 20 };
+
+// Rate limiting per call site, keyed on the format string pointer and message id (log_key_)
+struct log_site {
+    std::atomic<u64> key;
+    std::atomic<u32> window_start_ms;
+    std::atomic<u32> count;
+    std::atomic<u32> suppressed;
+};
+
+static constexpr u32 log_site_count_ = 256;
+static log_site sites_[log_site_count_];
+
+static const char *severity_prefixes_[log_severity_count] = {
+    "info: ", "warning: ", "error: "
+};
+
+static u32 now_ms_() {
+    using namespace std::chrono;
+    return (u32)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static log_site *find_site_(u64 key) {
+    u32 hash = (u32)(((key ^ (key >> 32)) >> 3) * 2654435761u) % log_site_count_;
+
+    for (u32 probe = 0; probe < log_site_count_; ++probe) {
+        log_site &site = sites_[(hash + probe) % log_site_count_];
+
+        u64 current = site.key.load(std::memory_order_acquire);
+        if (current == key) {
+            return &site;
+        }
+
+        if (current == 0) {
+            if (site.key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+                return &site;
+            }
+
+            if (current == key) {
+                return &site;
+            }
+        }
+    }
+
+    // Table is full, those sites just don't get limited
+    return nullptr;
+}
+
+bool should_log_(log_severity severity, u64 key) {
+    if (!(enabled_severities_.load(std::memory_order_relaxed) & (1 << severity))) {
+        return false;
+    }
+
+    u32 limit = rate_limit_.load(std::memory_order_relaxed);
+    if (!limit) {
+        return true;
+    }
+
+    log_site *site = find_site_(key);
+    if (!site) {
+        return true;
+    }
+
+    u32 now = now_ms_();
+    u32 window_start = site->window_start_ms.load(std::memory_order_relaxed);
+
+    if (now - window_start >= 1000 &&
+        site->window_start_ms.compare_exchange_strong(window_start, now, std::memory_order_relaxed)) {
+        site->count.store(0, std::memory_order_relaxed);
+    }
+
+    if (site->count.fetch_add(1, std::memory_order_relaxed) < limit) {
+        return true;
+    }
+
+    site->suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void push_log_(log_severity severity, u64 key, const char *str, const log_payload &payload) {
+    bool is_pushed = ring_.push([&] (log_record &record) {
+        record.severity = severity;
+        record.key = key;
+        record.format = str;
+        memcpy(record.payload.bytes, payload.bytes, payload.size);
+        record.payload.size = payload.size;
+        record.payload.arg_count = payload.arg_count;
+        record.payload.is_truncated = payload.is_truncated;
+    });
+
+    // Full, never block the caller
+    if (!is_pushed) {
+        dropped_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// The argument a '*' width or precision takes, as an integer whatever got captured
+static s64 read_star_arg_(const log_payload &payload, u32 &read_offset, u32 &args_left) {
+    log_arg_type type = (log_arg_type)payload.bytes[read_offset++];
+    --args_left;
+
+    switch (type) {
+    case log_arg_s64: case log_arg_u64: {
+        u64 value;
+        memcpy(&value, payload.bytes + read_offset, sizeof(value));
+        read_offset += sizeof(value);
+        return (s64)value;
+    }
+
+    case log_arg_f64: {
+        f64 value;
+        memcpy(&value, payload.bytes + read_offset, sizeof(value));
+        read_offset += sizeof(value);
+        return (s64)value;
+    }
+
+    case log_arg_str: {
+        u16 str_length;
+        memcpy(&str_length, payload.bytes + read_offset, sizeof(u16));
+        read_offset += sizeof(u16) + str_length;
+        return 0;
+    }
+
+    case log_arg_ptr:
+        read_offset += sizeof(void *);
+        return 0;
+    }
+
+    return 0;
+}
+
+// Formats a single conversion with the captured argument matching it
+static void format_spec_(FILE *out, const char *spec_begin, const char *spec_end,
+    const log_payload &payload, u32 &read_offset, u32 &args_left) {
+    // Strip the length modifiers, they get replaced with ones matching the captured type.
+    // Widths and precisions given as '*' get printed into the spec
+    char spec[64];
+    u32 length = 0;
+    for (const char *c = spec_begin; c < spec_end - 1 && length < sizeof(spec) - 24; ++c) {
+        if (*c == '*') {
+            if (!args_left) {
+                fputs("<missing>", out);
+                return;
+            }
+
+            s64 value = read_star_arg_(payload, read_offset, args_left);
+            if (value < 0 && spec[length - 1] == '.') {
+                // A negative precision counts as none
+                --length;
+            }
+            else {
+                length += snprintf(spec + length, sizeof(spec) - length, "%lld", (long long)value);
+            }
+        }
+        else if (!strchr("hljztL", *c)) {
+            spec[length++] = *c;
+        }
+    }
+
+    char conversion = *(spec_end - 1);
+
+    if (!args_left) {
+        fputs("<missing>", out);
+        return;
+    }
+
+    log_arg_type type = (log_arg_type)payload.bytes[read_offset++];
+    --args_left;
+
+    switch (type) {
+    case log_arg_s64: case log_arg_u64: {
+        u64 value;
+        memcpy(&value, payload.bytes + read_offset, sizeof(value));
+        read_offset += sizeof(value);
+
+        if (strchr("fFeEgGaA", conversion)) {
+            spec[length++] = conversion;
+            spec[length] = 0;
+            fprintf(out, spec, type == log_arg_s64 ? (f64)(s64)value : (f64)value);
+        }
+        else if (conversion == 'c') {
+            spec[length++] = conversion;
+            spec[length] = 0;
+            fprintf(out, spec, (int)value);
+        }
+        else {
+            spec[length++] = 'l';
+            spec[length++] = 'l';
+            spec[length++] = strchr("diuoxX", conversion) ? conversion : 'd';
+            spec[length] = 0;
+            fprintf(out, spec, value);
+        }
+    } break;
+
+    case log_arg_f64: {
+        f64 value;
+        memcpy(&value, payload.bytes + read_offset, sizeof(value));
+        read_offset += sizeof(value);
+
+        spec[length++] = strchr("fFeEgGaA", conversion) ? conversion : 'g';
+        spec[length] = 0;
+        fprintf(out, spec, value);
+    } break;
+
+    case log_arg_str: {
+        u16 str_length;
+        memcpy(&str_length, payload.bytes + read_offset, sizeof(u16));
+        read_offset += sizeof(u16);
+
+        char str[log_payload_size];
+        memcpy(str, payload.bytes + read_offset, str_length);
+        str[str_length] = 0;
+        read_offset += str_length;
+
+        spec[length++] = 's';
+        spec[length] = 0;
+        fprintf(out, spec, str);
+    } break;
+
+    case log_arg_ptr: {
+        void *value;
+        memcpy(&value, payload.bytes + read_offset, sizeof(value));
+        read_offset += sizeof(value);
+
+        fprintf(out, "%p", value);
+    } break;
+    }
+}
+
+static void format_record_(const log_record &record) {
+    FILE *out = stdout;
+    fputs(severity_prefixes_[record.severity], out);
+
+    u32 read_offset = 0;
+    u32 args_left = record.payload.arg_count;
+
+    for (const char *c = record.format; *c; ++c) {
+        if (*c != '%') {
+            fputc(*c, out);
+            continue;
+        }
+
+        if (c[1] == '%') {
+            fputc('%', out);
+            ++c;
+            continue;
+        }
+
+        // Find the conversion character
+        const char *spec_end = c + 1;
+        while (*spec_end && !strchr("diouxXeEfFgGaAcspn", *spec_end)) {
+            ++spec_end;
+        }
+
+        if (!*spec_end) {
+            fputs(c, out);
+            break;
+        }
+
+        ++spec_end;
+        format_spec_(out, c, spec_end, record.payload, read_offset, args_left);
+        c = spec_end - 1;
+    }
+
+    if (record.payload.is_truncated) {
+        fputs(" [truncated]", out);
+    }
+
+    log_site *site = find_site_(record.key);
+    if (site) {
+        u32 suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+        if (suppressed) {
+            fprintf(out, " [%u similar messages suppressed]", suppressed);
+        }
+    }
+
+    fputc('\n', out);
+}
+
+// Only ever called by one thread at a time (the log thread, or shutdown after joining it)
+static bool drain_() {
+    bool did_work = ring_.drain(&format_record_) != 0;
+
+    if (did_work) {
+        fflush(stdout);
+    }
+
+    return did_work;
+}
+
+static void log_thread_proc_() {
+    while (is_running_.load(std::memory_order_acquire)) {
+        if (!drain_()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+}
+
+void init_log() {
+    if (is_initialized_.exchange(true)) {
+        return;
+    }
+
+    is_running_.store(true, std::memory_order_release);
+    thread_ = std::thread(&log_thread_proc_);
+}
+
+void shutdown_log() {
+    if (is_initialized_.exchange(false)) {
+        is_running_.store(false, std::memory_order_release);
+        thread_.join();
+    }
+
+    drain_();
+
+    u64 dropped = dropped_count_.load(std::memory_order_relaxed);
+    if (dropped) {
+        printf("warning: %llu log messages were dropped\n", (unsigned long long)dropped);
+    }
+}
+
+void set_log_severity_enabled(log_severity severity, bool enabled) {
+    if (enabled) {
+        enabled_severities_.fetch_or(1 << severity, std::memory_order_relaxed);
+    }
+    else {
+        enabled_severities_.fetch_and(~(1 << severity), std::memory_order_relaxed);
+    }
+}
+
+void set_log_rate_limit(u32 messages_per_second) {
+    rate_limit_.store(messages_per_second, std::memory_order_relaxed);
+}
+
+u64 get_dropped_log_count() {
+    return dropped_count_.load(std::memory_order_relaxed);
+}
+
+void panic_and_exit() {
+    shutdown_log();
+    printf("panic - stopping session\n");
+    exit(-1);
+}
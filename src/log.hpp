@@ -1,31 +1,171 @@
 #pragma once
 
+#include <atomic>
 #include <utility>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+
+#include "types.hpp"
+
+/* Logging doesn't format on the calling thread. The format string pointer and
+ * the arguments get captured in binary form into a lock-free ring, and a
+ * background thread turns them into text. Format strings therefore have to
+ * be string literals (or otherwise outlive the process), string arguments get
+ * copied. */
+
+enum log_severity : u32 {
+    log_severity_info,
+    log_severity_warning,
+    log_severity_error,
+    log_severity_count
+};
+
+// Starts the formatting thread, messages logged before this are kept until then
+void init_log();
+// Formats everything that is still queued and stops the thread
+void shutdown_log();
+
+void set_log_severity_enabled(log_severity severity, bool enabled);
+// Messages per second allowed for each call site (format string, or message id
+// for log_with_id), 0 disables the limit
+void set_log_rate_limit(u32 messages_per_second);
+
+// Messages which were dropped because the ring was full
+u64 get_dropped_log_count();
+
+// Binary argument capture
+enum log_arg_type : u8 {
+    log_arg_s64, log_arg_u64, log_arg_f64, log_arg_str, log_arg_ptr
+};
+
+constexpr u32 log_record_size = 512;
+constexpr u32 log_payload_size = log_record_size - 32;
+
+struct log_payload {
+    u8 bytes[log_payload_size];
+    u32 size;
+    u32 arg_count;
+    // Set when an argument didn't fit
+    bool is_truncated;
+};
+
+inline void log_put_(log_payload &payload, log_arg_type type, const void *data, u32 size) {
+    if (payload.is_truncated || payload.size + 1 + size > log_payload_size) {
+        payload.is_truncated = true;
+        return;
+    }
+
+    payload.bytes[payload.size++] = type;
+    memcpy(payload.bytes + payload.size, data, size);
+    payload.size += size;
+    ++payload.arg_count;
+}
+
+inline void log_capture_str_(log_payload &payload, const char *str) {
+    if (!str) {
+        str = "(null)";
+    }
+
+    // Strings are stored as u16 length + characters, cut to whatever space is left
+    u32 length = strlen(str);
+    u32 space = log_payload_size - payload.size;
+    if (payload.is_truncated || space < 1 + sizeof(u16) + 1) {
+        payload.is_truncated = true;
+        return;
+    }
+
+    if (length > space - 1 - sizeof(u16)) {
+        length = space - 1 - sizeof(u16);
+    }
+
+    u16 stored_length = (u16)length;
+    payload.bytes[payload.size++] = log_arg_str;
+    memcpy(payload.bytes + payload.size, &stored_length, sizeof(u16));
+    payload.size += sizeof(u16);
+    memcpy(payload.bytes + payload.size, str, length);
+    payload.size += length;
+    ++payload.arg_count;
+}
+
+template <typename T>
+void log_capture_(log_payload &payload, const T &value) {
+    using type = typename std::decay<T>::type;
+
+    if constexpr (std::is_same<type, const char *>::value || std::is_same<type, char *>::value) {
+        log_capture_str_(payload, value);
+    }
+    else if constexpr (std::is_floating_point<type>::value) {
+        f64 v = value;
+        log_put_(payload, log_arg_f64, &v, sizeof(v));
+    }
+    else if constexpr (std::is_enum<type>::value) {
+        s64 v = (s64)value;
+        log_put_(payload, log_arg_s64, &v, sizeof(v));
+    }
+    else if constexpr (std::is_integral<type>::value && std::is_signed<type>::value) {
+        s64 v = value;
+        log_put_(payload, log_arg_s64, &v, sizeof(v));
+    }
+    else if constexpr (std::is_integral<type>::value) {
+        u64 v = value;
+        log_put_(payload, log_arg_u64, &v, sizeof(v));
+    }
+    else {
+        static_assert(std::is_pointer<type>::value, "Unsupported log argument type");
+        const void *v = (const void *)value;
+        log_put_(payload, log_arg_ptr, &v, sizeof(v));
+    }
+}
+
+// What the rate limit counts messages by: the format string, mixed with the id if there is one
+inline u64 log_key_(const char *str, u64 id) {
+    u64 key = (u64)(uintptr_t)str ^ (id * 0x9e3779b97f4a7c15ull);
+    return key ? key : 1;
+}
+
+// Cheap checks done before anything gets captured
+bool should_log_(log_severity severity, u64 key);
+void push_log_(log_severity severity, u64 key, const char *str, const log_payload &payload);
+
+template <typename ...FormatArgs>
+void log_message_(log_severity severity, u64 key, const char *str, FormatArgs &&...params) {
+    if (!should_log_(severity, key)) {
+        return;
+    }
+
+    log_payload payload;
+    payload.size = 0;
+    payload.arg_count = 0;
+    payload.is_truncated = false;
+
+    (log_capture_(payload, params), ...);
+
+    push_log_(severity, key, str, payload);
+}
 
 template <typename ...FormatArgs>
 void log_error(const char *str, FormatArgs &&...params) {
-    printf("error: ");
-    printf(str, std::forward<FormatArgs>(params)...);
-    putchar('\n');
+    log_message_(log_severity_error, log_key_(str, 0), str, std::forward<FormatArgs>(params)...);
 }
 
 template <typename ...FormatArgs>
 void log_warning(const char *str, FormatArgs &&...params) {
-    printf("warning: ");
-    printf(str, std::forward<FormatArgs>(params)...);
-    putchar('\n');
+    log_message_(log_severity_warning, log_key_(str, 0), str, std::forward<FormatArgs>(params)...);
 }
 
 template <typename ...FormatArgs>
 void log_info(const char *str, FormatArgs &&...params) {
-    printf("info: ");
-    printf(str, std::forward<FormatArgs>(params)...);
-    putchar('\n');
+    log_message_(log_severity_info, log_key_(str, 0), str, std::forward<FormatArgs>(params)...);
 }
 
-inline void panic_and_exit() {
-    printf("panic - stopping session\n");
-    exit(-1);
+// For call sites which pass many different messages through one format string
+// (the validation layer), each id gets rate limited on its own
+template <typename ...FormatArgs>
+void log_with_id(log_severity severity, u64 id, const char *str, FormatArgs &&...params) {
+    log_message_(severity, log_key_(str, id), str, std::forward<FormatArgs>(params)...);
 }
+
+// Flushes the log before exiting so the reason isn't lost
+[[noreturn]] void panic_and_exit();
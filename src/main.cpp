@@ -1,16 +1,55 @@
+#include "log.hpp"
+#include "blob.hpp"
+#include "jobs.hpp"
+#include "sim.hpp"
 #include "time.hpp"
+#include "memory.hpp"
 #include "core_render.hpp"
+#include "scene_shader.hpp"
+#include "gpu_primitives.hpp"
 #include "render_context.hpp"
 
 int main(int argc, char **argv) {
+    // Optional scene file (.mscn), --gpu-primitives runs the primitive self test and exits
+    const char *scene_path = nullptr;
+    bool is_testing_primitives = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--gpu-primitives")) {
+            is_testing_primitives = true;
+        }
+        else {
+            scene_path = argv[i];
+        }
+    }
+
+    init_log();
+    init_persistent_arena(megabytes(4));
+    init_jobs();
+
     init_render_context();
-    init_core_render();
+    init_core_render(scene_path);
+
+    if (is_testing_primitives) {
+        bool is_ok = test_gpu_primitives();
+        shutdown_blobs();
+        shutdown_jobs();
+        shutdown_log();
+        return is_ok ? 0 : 1;
+    }
+
     init_time();
+    start_sim();
 
     while (is_running()) {
         run_render();
         end_frame_time();
     }
 
+    stop_sim();
+    shutdown_scene_shader();
+    shutdown_blobs();
+    shutdown_jobs();
+    shutdown_log();
+
     return 0;
 }
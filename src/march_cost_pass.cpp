@@ -0,0 +1,89 @@
+#include "log.hpp"
+#include "time.hpp"
+#include "compute.hpp"
+#include "core_render.hpp"
+
+// Per-pixel and total cost of blob_cast, written by the blob_cast_instrumented variant
+
+struct march_cost_view_settings {
+    u32 channel;
+    f32 max_value;
+};
+
+static compute_pass view_pass_;
+
+// One readback buffer per frame in flight so the counters never stall the GPU
+static small_vector<gpu_buffer, 3> readback_buffers_;
+static heap_array<bool> readback_pending_;
+
+static u32 view_channel_;
+static f32 last_log_time_;
+
+static const char *channel_names_[] = { "march steps", "shadow steps", "map() calls" };
+static const f32 channel_max_values_[] = { 64.0f, 50.0f, 128.0f };
+
+void init_march_cost_pass(u32 frames_in_flight) {
+    ggfx->march_cost_image = make_storage_texture(
+        gctx->swapchain_extent.width, gctx->swapchain_extent.height,
+        VK_FORMAT_R32G32B32A32_UINT);
+
+    ggfx->march_cost_counters = make_storage_buffer(sizeof(march_cost_stats));
+
+    readback_pending_ = heap_array<bool>(frames_in_flight, false);
+    for (u32 i = 0; i < frames_in_flight; ++i) {
+        readback_buffers_.emplace_back(make_readback_buffer(sizeof(march_cost_stats)));
+    }
+
+    view_pass_ = make_compute_pass<march_cost_view_settings>(
+        "march_cost_view",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE }
+    );
+}
+
+void update_march_cost_controls() {
+    if (was_key_pressed(GLFW_KEY_F1)) {
+        ggfx->is_instrumented = !ggfx->is_instrumented;
+        ggfx->show_march_cost = ggfx->is_instrumented;
+    }
+
+    if (was_key_pressed(GLFW_KEY_F2) && ggfx->is_instrumented) {
+        view_channel_ = (view_channel_ + 1) % 3;
+        log_info("march cost view: %s", channel_names_[view_channel_]);
+    }
+}
+
+// Called once the fence of this frame has signaled
+void read_march_cost_stats(u32 frame) {
+    if (!readback_pending_[frame]) {
+        return;
+    }
+
+    memcpy(&ggfx->march_stats, readback_buffers_[frame].mapped(), sizeof(march_cost_stats));
+    readback_pending_[frame] = false;
+
+    if (gtime->current_time - last_log_time_ > 1.0f) {
+        u32 pixel_count = gctx->swapchain_extent.width * gctx->swapchain_extent.height;
+        log_info("march cost: %u march steps, %u shadow steps, %u map() calls (%.1f per pixel), %u hit pixels",
+            ggfx->march_stats.march_steps, ggfx->march_stats.shadow_steps, ggfx->march_stats.map_calls,
+            (f32)ggfx->march_stats.map_calls / (f32)pixel_count, ggfx->march_stats.hit_pixels);
+
+        last_log_time_ = gtime->current_time;
+    }
+}
+
+void begin_march_cost(render_graph &graph) {
+    ggfx->march_cost_counters.clear(graph);
+}
+
+void run_march_cost_pass(render_graph &graph, texture &target, u32 frame) {
+    ggfx->march_cost_counters.copy_to(graph, readback_buffers_[frame]);
+    readback_pending_[frame] = true;
+
+    if (ggfx->show_march_cost) {
+        march_cost_view_settings settings = { view_channel_, channel_max_values_[view_channel_] };
+
+        view_pass_.bind_resources(graph, &settings, target, ggfx->march_cost_image);
+        view_pass_.run(graph, (gctx->swapchain_extent.width + 15) / 16, (gctx->swapchain_extent.height + 15) / 16, 1);
+    }
+}
@@ -0,0 +1,110 @@
+#include "log.hpp"
+#include "memory.hpp"
+
+#include <new>
+#include <stdlib.h>
+
+static mem_category_stats stats_[mem_category_count];
+
+static const char *category_names_[mem_category_count] = {
+    "general", "persistent", "frame"
+};
+
+static linear_allocator persistent_arena_;
+
+static linear_allocator *frame_allocators_;
+static u32 frame_allocator_count_;
+static u32 current_frame_allocator_;
+
+const mem_category_stats &get_mem_stats(mem_category category) {
+    return stats_[category];
+}
+
+const char *get_mem_category_name(mem_category category) {
+    return category_names_[category];
+}
+
+void track_alloc(mem_category category, u64 size) {
+    mem_category_stats &stats = stats_[category];
+    stats.allocation_count.fetch_add(1, std::memory_order_relaxed);
+    u64 bytes = stats.bytes.fetch_add(size, std::memory_order_relaxed) + size;
+
+    u64 peak = stats.peak_bytes.load(std::memory_order_relaxed);
+    while (bytes > peak && !stats.peak_bytes.compare_exchange_weak(peak, bytes, std::memory_order_relaxed));
+}
+
+void track_free(mem_category category, u64 size) {
+    stats_[category].bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+void *mem_alloc_raw(u64 size, u32 alignment, mem_category category) {
+    void *ptr = ::operator new(size, std::align_val_t(alignment));
+    track_alloc(category, size);
+    return ptr;
+}
+
+void mem_free_raw(void *ptr, u64 size, u32 alignment, mem_category category) {
+    if (ptr) {
+        ::operator delete(ptr, std::align_val_t(alignment));
+        track_free(category, size);
+    }
+}
+
+linear_allocator::linear_allocator()
+: memory_(nullptr), capacity_(0), used_(0), category_(mem_category_general) {
+
+}
+
+void linear_allocator::init(u32 capacity, mem_category category) {
+    category_ = category;
+    capacity_ = capacity;
+    used_.store(0, std::memory_order_relaxed);
+    memory_ = (u8 *)mem_alloc_raw(capacity, alignof(std::max_align_t), category);
+}
+
+void *linear_allocator::allocate(u32 size, u32 alignment) {
+    // Reserve enough for the worst case padding so that a single atomic add is enough
+    u32 reserved = size + alignment - 1;
+    u32 offset = used_.fetch_add(reserved, std::memory_order_relaxed);
+
+    if (offset + reserved > capacity_) {
+        log_error("Linear allocator (%s) ran out of memory: %u / %u bytes",
+            category_names_[category_], offset + reserved, capacity_);
+        panic_and_exit();
+    }
+
+    uintptr_t address = (uintptr_t)(memory_ + offset);
+    address = (address + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+    return (void *)address;
+}
+
+void linear_allocator::reset() {
+    used_.store(0, std::memory_order_relaxed);
+}
+
+void init_persistent_arena(u32 capacity) {
+    persistent_arena_.init(capacity, mem_category_persistent);
+}
+
+linear_allocator &get_persistent_arena() {
+    return persistent_arena_;
+}
+
+void init_frame_allocator(u32 frames_in_flight, u32 capacity_per_frame) {
+    frame_allocator_count_ = frames_in_flight;
+    frame_allocators_ = mem_allocv<linear_allocator>(frames_in_flight);
+
+    for (u32 i = 0; i < frames_in_flight; ++i) {
+        frame_allocators_[i].init(capacity_per_frame, mem_category_frame);
+    }
+}
+
+void begin_frame_allocator(u32 frame) {
+    current_frame_allocator_ = frame;
+    frame_allocators_[frame].reset();
+}
+
+linear_allocator &get_frame_allocator() {
+    return frame_allocators_[current_frame_allocator_];
+}
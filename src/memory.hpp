@@ -1,31 +1,95 @@
 #pragma once
 
+#include <new>
+#include <atomic>
 #include <utility>
+#include <assert.h>
 #include <string.h>
 #include "types.hpp"
 
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <alloca.h>
+#endif
+
 inline constexpr u32 kilobytes(u32 kb) { return(kb * 1024); }
 inline constexpr u32 megabytes(u32 mb) { return(kilobytes(mb * 1024)); }
 
-// For now, these all invoke new/delete
+// Every host allocation is counted under one of these
+enum mem_category : u32 {
+    mem_category_general,
+    mem_category_persistent,
+    mem_category_frame,
+    mem_category_count
+};
+
+struct mem_category_stats {
+    std::atomic<u64> allocation_count;
+    std::atomic<u64> bytes;
+    std::atomic<u64> peak_bytes;
+};
+
+const mem_category_stats &get_mem_stats(mem_category category);
+const char *get_mem_category_name(mem_category category);
+
+void track_alloc(mem_category category, u64 size);
+void track_free(mem_category category, u64 size);
+
+// Raw, tracked heap allocations
+void *mem_alloc_raw(u64 size, u32 alignment, mem_category category = mem_category_general);
+void mem_free_raw(void *ptr, u64 size, u32 alignment, mem_category category = mem_category_general);
+
 template <typename T, typename ...Args>
 T *mem_alloc(Args &&...args) {
-    return new T(std::forward<Args>(args)...);
+    void *ptr = mem_alloc_raw(sizeof(T), alignof(T));
+    return new(ptr) T(std::forward<Args>(args)...);
 }
 
-template <typename T, typename ...Args>
-T *mem_allocv(u32 count, Args &&...args) {
-    return new T[count] {std::forward<Args>(args)...};
+template <typename T>
+void mem_free(T *ptr) {
+    if (ptr) {
+        ptr->~T();
+        mem_free_raw(ptr, sizeof(T), alignof(T));
+    }
 }
 
+// Arrays keep their count in a header in front of the first element so that
+// mem_freev can destroy them and report the size
 template <typename T>
-void mem_free(T *ptr) {
-    delete ptr;
+constexpr u32 mem_array_header_size_() {
+    return alignof(T) > sizeof(u64) ? alignof(T) : sizeof(u64);
+}
+
+template <typename T, typename ...Args>
+T *mem_allocv(u32 count, const Args &...args) {
+    constexpr u32 header = mem_array_header_size_<T>();
+    u8 *raw = (u8 *)mem_alloc_raw(header + sizeof(T) * count, header);
+    *(u64 *)(raw + header - sizeof(u64)) = count;
+
+    T *ptr = (T *)(raw + header);
+    for (u32 i = 0; i < count; ++i) {
+        new(&ptr[i]) T(args...);
+    }
+
+    return ptr;
 }
 
 template <typename T>
 void mem_freev(T *ptr) {
-    delete[] ptr;
+    if (!ptr) {
+        return;
+    }
+
+    constexpr u32 header = mem_array_header_size_<T>();
+    u8 *raw = (u8 *)ptr - header;
+    u64 count = *(u64 *)(raw + header - sizeof(u64));
+
+    for (u64 i = 0; i < count; ++i) {
+        ptr[i].~T();
+    }
+
+    mem_free_raw(raw, header + sizeof(T) * count, header);
 }
 
 inline void zero_memory(void *ptr, u32 size) {
@@ -42,4 +106,51 @@ inline void zero_memory(u32 count, T *ptr) {
     memset(ptr, 0, sizeof(T) * count);
 }
 
-#define stack_alloc(type, count) (type *)alloca(sizeof(type) * (count))
+// Bump allocator over a fixed block. Allocation is lock free so jobs can use
+// the frame allocator too, freeing only happens all at once with reset()
+class linear_allocator {
+public:
+    linear_allocator();
+
+    void init(u32 capacity, mem_category category);
+
+    void *allocate(u32 size, u32 alignment);
+    void reset();
+
+    u32 used() const { return used_.load(std::memory_order_relaxed); }
+    u32 capacity() const { return capacity_; }
+
+private:
+    u8 *memory_;
+    u32 capacity_;
+    std::atomic<u32> used_;
+    mem_category category_;
+};
+
+// Lives until the program exits (render context, graphics resources, ...)
+void init_persistent_arena(u32 capacity);
+linear_allocator &get_persistent_arena();
+
+template <typename T, typename ...Args>
+T *arena_alloc(Args &&...args) {
+    void *ptr = get_persistent_arena().allocate(sizeof(T), alignof(T));
+    return new(ptr) T(std::forward<Args>(args)...);
+}
+
+// One linear allocator per frame in flight, begin_frame_allocator resets the
+// region of a frame once its fence has signaled
+void init_frame_allocator(u32 frames_in_flight, u32 capacity_per_frame);
+void begin_frame_allocator(u32 frame);
+linear_allocator &get_frame_allocator();
+
+// Uninitialized storage which is only valid until this frame comes around again
+template <typename T>
+T *frame_allocv(u32 count) {
+    return (T *)get_frame_allocator().allocate(sizeof(T) * count, alignof(T));
+}
+
+// alloca for small, short lived arrays - anything bigger belongs in the frame allocator
+constexpr u32 max_stack_alloc_size = kilobytes(16);
+
+#define stack_alloc(type, count) \
+    (assert(sizeof(type) * (count) <= max_stack_alloc_size), (type *)alloca(sizeof(type) * (count)))
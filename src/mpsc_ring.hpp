@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+
+#include "types.hpp"
+
+/* Bounded lock-free MPSC ring (Vyukov style): each slot carries a sequence
+ * number which tells producers whether it's free and the consumer whether
+ * it's been written. Producers never block, a full ring turns them away.
+ *
+ * Sequence numbers are stored relative to the slot index, so an all zero
+ * ring is an empty one. Rings are meant to be statics: those are zeroed
+ * before any code runs, so pushing from static initializers is fine. */
+template <typename T, u32 Capacity>
+class mpsc_ring {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Ring capacity has to be a power of two");
+
+public:
+    // Any thread. fill gets the slot to write the item into, false when the ring is full
+    template <typename Fill>
+    bool push(Fill &&fill) {
+        u64 pos = enqueue_pos_.load(std::memory_order_relaxed);
+        slot *s;
+
+        for (;;) {
+            s = &slots_[pos & mask_];
+            u64 sequence = s->sequence.load(std::memory_order_acquire) + (pos & mask_);
+            s64 diff = (s64)sequence - (s64)pos;
+
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        fill(s->item);
+        s->sequence.store(pos + 1 - (pos & mask_), std::memory_order_release);
+
+        return true;
+    }
+
+    // Only ever one thread at a time. Hands every written item to consume in
+    // order and returns how many there were
+    template <typename Consume>
+    u32 drain(Consume &&consume) {
+        u32 count = 0;
+
+        for (;;) {
+            u64 idx = dequeue_pos_ & mask_;
+            slot &s = slots_[idx];
+            u64 sequence = s.sequence.load(std::memory_order_acquire) + idx;
+
+            if ((s64)sequence - (s64)(dequeue_pos_ + 1) < 0) {
+                break;
+            }
+
+            consume((const T &)s.item);
+
+            s.sequence.store(dequeue_pos_ + Capacity - idx, std::memory_order_release);
+            ++dequeue_pos_;
+            ++count;
+        }
+
+        return count;
+    }
+
+private:
+    static constexpr u64 mask_ = Capacity - 1;
+
+    struct slot {
+        std::atomic<u64> sequence;
+        T item;
+    };
+
+    slot slots_[Capacity];
+    std::atomic<u64> enqueue_pos_;
+    u64 dequeue_pos_;
+};
@@ -0,0 +1,67 @@
+#include "compute.hpp"
+#include "core_render.hpp"
+
+/* Bit per cell occupancy grid (occupancy.glsl) which blob_cast walks with a
+ * DDA to skip empty cells in the primary march. Finer than the distance
+ * pyramid and only a bit per cell. Reuses the pyramid to leave cells which
+ * are known to be empty alone. Only holds the static blobs, like the brick
+ * map, so it only gets rebuilt when those change: blob_cast keeps its skips
+ * clear of the dynamic blobs itself. */
+
+// Same as occupancy.glsl
+static constexpr u32 occupancy_size_ = 128;
+static constexpr u32 word_count_ = occupancy_size_ * occupancy_size_ * occupancy_size_ / 32;
+
+static constexpr u32 group_size_ = 64;
+
+struct occupancy_settings_ {
+    // The pyramid's region, see distance_pyramid_pass.cpp
+    v4 region;
+};
+
+static compute_pass build_pass_;
+
+// Nothing was built yet, or a CSG program kept the grid from following the edits
+static bool needs_build_;
+
+void init_occupancy_pass() {
+    ggfx->occupancy_grid = make_storage_buffer(word_count_ * sizeof(u32));
+
+    build_pass_ = make_compute_pass<occupancy_settings_>(
+        "occupancy_build",
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        uprototype{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE },
+        uprototype{ VK_DESCRIPTOR_TYPE_SAMPLER },
+        uprototype{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }
+    );
+
+    ggfx->is_occupancy_ready = false;
+    needs_build_ = true;
+}
+
+// Runs after the distance pyramid, every word gets written so no clear is needed
+void run_occupancy_pass(render_graph &graph) {
+    // The BVH isn't built while a CSG program runs, blob_cast doesn't walk the grid then anyway
+    if (ggfx->is_csg_program_active) {
+        needs_build_ = true;
+        ggfx->is_occupancy_ready = false;
+        return;
+    }
+
+    if (!needs_build_ && !ggfx->blob_view->is_static_changed) {
+        return;
+    }
+
+    // Covers the pyramid's region, there is none without static additions
+    needs_build_ = false;
+    ggfx->is_occupancy_ready = ggfx->is_distance_pyramid_ready;
+    if (!ggfx->is_occupancy_ready) {
+        return;
+    }
+
+    occupancy_settings_ settings = { ggfx->pyramid_region };
+    build_pass_.bind_resources(graph, &settings,
+        ggfx->blob_data, ggfx->blob_bvh, ggfx->distance_pyramid, ggfx->linear_sampler, ggfx->occupancy_grid);
+    build_pass_.run(graph, (word_count_ + group_size_ - 1) / group_size_, 1, 1);
+}
@@ -0,0 +1,150 @@
+#include "log.hpp"
+#include "profiler.hpp"
+#include "render_context.hpp"
+
+#include <chrono>
+
+const profiler_data *gprofiler;
+
+static profiler_data profiler_;
+
+// One query pool per frame in flight, two timestamps per zone plus the frame bounds
+struct frame_queries {
+    VkQueryPool pool;
+    const char *names[max_gpu_zones];
+    u32 zone_count;
+    bool is_pending;
+    // Recording and submitting, kept until the timestamps come back
+    f32 cpu_ms;
+};
+
+static heap_array<frame_queries> frames_;
+static u32 recording_frame_;
+static f32 timestamp_period_ns_;
+static u32 pending_upload_bytes_;
+
+static std::chrono::high_resolution_clock::time_point record_start_;
+
+static constexpr u32 queries_per_frame_ = 2 + 2 * max_gpu_zones;
+
+void init_profiler(u32 frames_in_flight) {
+    gprofiler = &profiler_;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(gctx->gpu, &properties);
+    timestamp_period_ns_ = properties.limits.timestampPeriod;
+
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(gctx->gpu, &memory_properties);
+    for (u32 i = 0; i < memory_properties.memoryHeapCount; ++i) {
+        if (memory_properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            profiler_.device_local_heap_bytes += memory_properties.memoryHeaps[i].size;
+        }
+    }
+
+    frames_ = heap_array<frame_queries>(frames_in_flight);
+    for (u32 i = 0; i < frames_in_flight; ++i) {
+        VkQueryPoolCreateInfo pool_info = {};
+        pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        pool_info.queryCount = queries_per_frame_;
+
+        VK_CHECK(vkCreateQueryPool(gctx->device, &pool_info, nullptr, &frames_[i].pool));
+
+        frames_[i].zone_count = 0;
+        frames_[i].is_pending = false;
+        frames_[i].cpu_ms = 0.0f;
+    }
+}
+
+void read_profiler_results(u32 frame) {
+    frame_queries &queries = frames_[frame];
+    if (!queries.is_pending) {
+        return;
+    }
+
+    u64 timestamps[queries_per_frame_];
+    u32 query_count = 2 + 2 * queries.zone_count;
+
+    VkResult result = vkGetQueryPoolResults(gctx->device, queries.pool, 0, query_count,
+        sizeof(u64) * query_count, timestamps, sizeof(u64), VK_QUERY_RESULT_64_BIT);
+
+    queries.is_pending = false;
+
+    if (result != VK_SUCCESS) {
+        return;
+    }
+
+    f32 to_ms = timestamp_period_ns_ / 1000000.0f;
+
+    profiler_.gpu_frame_ms[profiler_.history_offset] = (f32)(timestamps[1] - timestamps[0]) * to_ms;
+    profiler_.cpu_frame_ms[profiler_.history_offset] = queries.cpu_ms;
+    profiler_.history_offset = (profiler_.history_offset + 1) % profiler_history_length;
+
+    profiler_.zone_count = queries.zone_count;
+    for (u32 i = 0; i < queries.zone_count; ++i) {
+        profiler_.zones[i].name = queries.names[i];
+        profiler_.zones[i].ms = (f32)(timestamps[3 + i * 2] - timestamps[2 + i * 2]) * to_ms;
+    }
+}
+
+void begin_profiler_frame(render_graph &graph, u32 frame) {
+    record_start_ = std::chrono::high_resolution_clock::now();
+    recording_frame_ = frame;
+
+    frame_queries &queries = frames_[frame];
+    queries.zone_count = 0;
+
+    vkCmdResetQueryPool(graph.cmdbuf(), queries.pool, 0, queries_per_frame_);
+    vkCmdWriteTimestamp(graph.cmdbuf(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queries.pool, 0);
+}
+
+void end_profiler_frame(render_graph &graph) {
+    frame_queries &queries = frames_[recording_frame_];
+    vkCmdWriteTimestamp(graph.cmdbuf(), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queries.pool, 1);
+    queries.is_pending = true;
+
+    profiler_.upload_bytes = pending_upload_bytes_;
+    pending_upload_bytes_ = 0;
+
+    auto record_end = std::chrono::high_resolution_clock::now();
+    profiler_.cpu_record_ms = std::chrono::duration<f32, std::milli>(record_end - record_start_).count();
+}
+
+void end_profiler_submit() {
+    auto submit_end = std::chrono::high_resolution_clock::now();
+    frames_[recording_frame_].cpu_ms = std::chrono::duration<f32, std::milli>(submit_end - record_start_).count();
+}
+
+u32 begin_gpu_zone(render_graph &graph, const char *name) {
+    frame_queries &queries = frames_[recording_frame_];
+
+    if (queries.zone_count == max_gpu_zones) {
+        log_warning("Ran out of GPU profiler zones (%s)", name);
+        return max_gpu_zones;
+    }
+
+    u32 zone = queries.zone_count++;
+    queries.names[zone] = name;
+
+    vkCmdWriteTimestamp(graph.cmdbuf(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queries.pool, 2 + zone * 2);
+
+    return zone;
+}
+
+void end_gpu_zone(render_graph &graph, u32 zone) {
+    if (zone == max_gpu_zones) {
+        return;
+    }
+
+    frame_queries &queries = frames_[recording_frame_];
+    vkCmdWriteTimestamp(graph.cmdbuf(), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queries.pool, 3 + zone * 2);
+}
+
+void count_upload_bytes(u32 size) {
+    pending_upload_bytes_ += size;
+}
+
+void count_device_memory(u64 size) {
+    profiler_.device_memory_bytes += size;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "types.hpp"
+#include "render_graph.hpp"
+
+constexpr u32 max_gpu_zones = 16;
+constexpr u32 profiler_history_length = 256;
+
+struct gpu_zone_timing {
+    const char *name;
+    f32 ms;
+};
+
+extern const struct profiler_data {
+    // Scrolling history, history_offset points at the oldest entry. The CPU
+    // side is recording plus submitting, for the same frames as the GPU side
+    f32 cpu_frame_ms[profiler_history_length];
+    f32 gpu_frame_ms[profiler_history_length];
+    u32 history_offset;
+
+    // CPU time spent recording the last frame
+    f32 cpu_record_ms;
+
+    // Timings of the most recently resolved frame
+    gpu_zone_timing zones[max_gpu_zones];
+    u32 zone_count;
+
+    // Bytes written to GPU buffers from the host in the last recorded frame
+    u32 upload_bytes;
+
+    // Device memory allocated through render_context helpers
+    u64 device_memory_bytes;
+    u64 device_local_heap_bytes;
+} *gprofiler;
+
+void init_profiler(u32 frames_in_flight);
+// Called after the fence of this frame has signaled
+void read_profiler_results(u32 frame);
+
+void begin_profiler_frame(render_graph &graph, u32 frame);
+void end_profiler_frame(render_graph &graph);
+// Right after the frame's command buffer got submitted
+void end_profiler_submit();
+
+// Zones must not nest and names must be string literals
+u32 begin_gpu_zone(render_graph &graph, const char *name);
+void end_gpu_zone(render_graph &graph, u32 zone);
+
+void count_upload_bytes(u32 size);
+void count_device_memory(u64 size);
@@ -5,12 +5,22 @@
 #include "log.hpp"
 #include "bits.hpp"
 #include "memory.hpp"
+#include "profiler.hpp"
 #include "render_context.hpp"
 
 #include <vector>
 
 render_context *gctx;
 
+// Keys which went down since the last poll_input
+static u8 pressed_keys_[GLFW_KEY_LAST + 1];
+
+static void key_callback_(GLFWwindow *window, s32 key, s32 scancode, s32 action, s32 mods) {
+    if (action == GLFW_PRESS && key >= 0 && key <= GLFW_KEY_LAST) {
+        pressed_keys_[key] = 1;
+    }
+}
+
 static void verify_validation_support_(const std::vector<const char *> &layers) {
     // TODO
 }
@@ -61,7 +71,7 @@ static void init_instance_() {
 
     VK_CHECK(vkCreateInstance(&instance_info, nullptr, &gctx->instance));
 
-    gctx->layers = layers;
+    gctx->layers = heap_array<const char *>(layers.data(), layers.size());
 }
 
 VKAPI_ATTR VkBool32 VKAPI_PTR debug_messenger_callback(
@@ -69,13 +79,19 @@ VKAPI_ATTR VkBool32 VKAPI_PTR debug_messenger_callback(
     VkDebugUtilsMessageTypeFlagsEXT type,
     const VkDebugUtilsMessengerCallbackDataEXT *data,
     void *) {
+    // This runs on whichever thread made the Vulkan call, the logger only
+    // captures the message here and formats it on its own thread
     if (type == VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT ||
         type == VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) {
-        log_error(
-            "Validation layer (%d;%d): %s\n",
-            type,
-            severity,
-            data->pMessage);
+        if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+            log_with_id(log_severity_error, (u32)data->messageIdNumber, "Validation layer (%d;%d): %s", type, severity, data->pMessage);
+        }
+        else if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+            log_with_id(log_severity_warning, (u32)data->messageIdNumber, "Validation layer (%d;%d): %s", type, severity, data->pMessage);
+        }
+        else {
+            log_with_id(log_severity_info, (u32)data->messageIdNumber, "Validation layer (%d;%d): %s", type, severity, data->pMessage);
+        }
     }
 
     return 0;
@@ -129,6 +145,8 @@ static void init_surface_() {
     }
 
     VK_CHECK(glfwCreateWindowSurface(gctx->instance, gctx->window, nullptr, &gctx->surface));
+
+    glfwSetKeyCallback(gctx->window, &key_callback_);
 }
 
 struct queue_families {
@@ -299,7 +317,8 @@ static void init_swapchain_() {
     swapchain_info.imageColorSpace = format.colorSpace;
     swapchain_info.imageExtent = surface_extent;
     swapchain_info.imageArrayLayers = 1;
-    swapchain_info.imageUsage = VK_IMAGE_USAGE_STORAGE_BIT;
+    // Compute passes write the image, the debug overlay then draws on top of it
+    swapchain_info.imageUsage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
     swapchain_info.imageSharingMode = (gctx->graphics_family == gctx->present_family) ?
         VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT;
@@ -394,7 +413,7 @@ void init_descriptor_layout_helper_() {
 }
 
 void init_render_context() {
-    gctx = mem_alloc<render_context>();
+    gctx = arena_alloc<render_context>();
     zero_memory(gctx);
     
     // Set all flags
@@ -424,9 +443,14 @@ bool is_running() {
 }
 
 void poll_input() {
+    zero_memory(pressed_keys_, sizeof(pressed_keys_));
     glfwPollEvents();
 }
 
+bool was_key_pressed(s32 key) {
+    return pressed_keys_[key];
+}
+
 u32 acquire_next_swapchain_image(VkSemaphore semaphore) {
     u32 idx = 0;
     vkAcquireNextImageKHR(gctx->device, gctx->swapchain, UINT64_MAX, semaphore, VK_NULL_HANDLE, &idx);
@@ -457,6 +481,9 @@ VkAccessFlags find_access_flags_for_stage(VkPipelineStageFlags stage) {
         case VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT:
             return VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
 
+        case VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT:
+            return VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
         case VK_PIPELINE_STAGE_VERTEX_INPUT_BIT:
             return VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
 
@@ -468,6 +495,12 @@ VkAccessFlags find_access_flags_for_stage(VkPipelineStageFlags stage) {
         case VK_PIPELINE_STAGE_TRANSFER_BIT:
             return VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
 
+        case VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT:
+            return VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+        case VK_PIPELINE_STAGE_HOST_BIT:
+            return VK_ACCESS_HOST_READ_BIT | VK_ACCESS_HOST_WRITE_BIT;
+
         case VK_PIPELINE_STAGE_ALL_COMMANDS_BIT:
             return VK_ACCESS_MEMORY_WRITE_BIT | VK_ACCESS_MEMORY_READ_BIT;
 
@@ -500,7 +533,7 @@ VkAccessFlags find_access_flags_for_layout(VkImageLayout layout) {
                 VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
         case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-            return VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            return VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
 
         default: {
             log_error("Didn't handle image layout for finding access flags!");
@@ -539,6 +572,7 @@ VkDeviceMemory allocate_buffer_memory(VkBuffer buffer, VkMemoryPropertyFlags pro
     vkAllocateMemory(gctx->device, &alloc_info, nullptr, &memory);
 
     vkBindBufferMemory(gctx->device, buffer, memory, 0);
+    count_device_memory(requirements.size);
 
     return memory;
 }
@@ -556,6 +590,7 @@ VkDeviceMemory allocate_image_memory(VkImage image, VkMemoryPropertyFlags proper
     vkAllocateMemory(gctx->device, &alloc_info, nullptr, &memory);
 
     vkBindImageMemory(gctx->device, image, memory, 0);
+    count_device_memory(requirements.size);
 
     if (size) {
         *size = requirements.size;
@@ -51,6 +51,8 @@ extern struct render_context {
 void init_render_context();
 bool is_running();
 void poll_input();
+// True only on the frame the key went down
+bool was_key_pressed(s32 key);
 u32 acquire_next_swapchain_image(VkSemaphore);
 void present_swapchain_image(VkSemaphore to_wait, u32 image_idx);
 
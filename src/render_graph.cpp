@@ -1,8 +1,27 @@
+#include "memory.hpp"
 #include "render_graph.hpp"
 #include "vulkan/vulkan_core.h"
 
+static constexpr u32 initial_barrier_capacity_ = 16;
+
+// Grows an array living in the frame allocator, the old storage just gets dropped with the frame
+template <typename T>
+static T *grow_barrier_array_(T *barriers, u32 count, u32 &capacity) {
+    u32 new_capacity = capacity ? capacity * 2 : initial_barrier_capacity_;
+    T *new_barriers = frame_allocv<T>(new_capacity);
+
+    if (count) {
+        memcpy(new_barriers, barriers, sizeof(T) * count);
+    }
+
+    capacity = new_capacity;
+    return new_barriers;
+}
+
 render_graph::render_graph(VkCommandBuffer command_buffer, flags one_time) 
-: command_buffer_(command_buffer) {
+: command_buffer_(command_buffer), src_stages_(0), dst_stages_(0),
+    buffer_barriers_(nullptr), buffer_barrier_count_(0), buffer_barrier_capacity_(0),
+    image_barriers_(nullptr), image_barrier_count_(0), image_barrier_capacity_(0) {
     VkCommandBufferBeginInfo begin_info = {};
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     begin_info.pInheritanceInfo = nullptr;
@@ -10,17 +29,53 @@ render_graph::render_graph(VkCommandBuffer command_buffer, flags one_time)
     vkBeginCommandBuffer(command_buffer, &begin_info);
 }
 
+void render_graph::add_barrier(VkPipelineStageFlags src, VkPipelineStageFlags dst, const VkBufferMemoryBarrier &barrier) {
+    if (buffer_barrier_count_ == buffer_barrier_capacity_) {
+        buffer_barriers_ = grow_barrier_array_(buffer_barriers_, buffer_barrier_count_, buffer_barrier_capacity_);
+    }
+
+    buffer_barriers_[buffer_barrier_count_++] = barrier;
+    src_stages_ |= src;
+    dst_stages_ |= dst;
+}
+
+void render_graph::add_barrier(VkPipelineStageFlags src, VkPipelineStageFlags dst, const VkImageMemoryBarrier &barrier) {
+    if (image_barrier_count_ == image_barrier_capacity_) {
+        image_barriers_ = grow_barrier_array_(image_barriers_, image_barrier_count_, image_barrier_capacity_);
+    }
+
+    image_barriers_[image_barrier_count_++] = barrier;
+    src_stages_ |= src;
+    dst_stages_ |= dst;
+}
+
+void render_graph::flush_barriers() {
+    if (buffer_barrier_count_ == 0 && image_barrier_count_ == 0) {
+        return;
+    }
+
+    vkCmdPipelineBarrier(command_buffer_, src_stages_, dst_stages_, 0, 0, nullptr,
+        buffer_barrier_count_, buffer_barriers_, image_barrier_count_, image_barriers_);
+
+    buffer_barrier_count_ = 0;
+    image_barrier_count_ = 0;
+    src_stages_ = 0;
+    dst_stages_ = 0;
+}
+
 void render_graph::submit(VkQueue queue, VkSemaphore to_wait, VkSemaphore to_signal, 
     VkPipelineStageFlags stage, VkFence fence) {
+    flush_barriers();
     vkEndCommandBuffer(command_buffer_);
 
     VkSubmitInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     info.commandBufferCount = 1;
     info.pCommandBuffers = &command_buffer_;
-    info.waitSemaphoreCount = 1;
+    // One time submissions (uploads) don't need to wait or signal anything
+    info.waitSemaphoreCount = to_wait != VK_NULL_HANDLE;
     info.pWaitSemaphores = &to_wait;
-    info.signalSemaphoreCount = 1;
+    info.signalSemaphoreCount = to_signal != VK_NULL_HANDLE;
     info.pSignalSemaphores = &to_signal;
     info.pWaitDstStageMask = &stage;
     vkQueueSubmit(queue, 1, &info, fence);
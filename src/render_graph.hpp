@@ -2,6 +2,8 @@
 
 #include <vulkan/vulkan.h>
 
+#include "types.hpp"
+
 // TODO: Make this a proper render graph (actually no need, make all resources track their own stuff)
 class render_graph {
 public:
@@ -13,11 +15,26 @@ public:
     void submit(VkQueue queue, VkSemaphore to_wait, VkSemaphore to_signal, 
         VkPipelineStageFlags stage, VkFence fence);
 
+    // Resources queue their barriers here so that binding several of them only
+    // costs one vkCmdPipelineBarrier. Storage comes from the frame allocator
+    void add_barrier(VkPipelineStageFlags src, VkPipelineStageFlags dst, const VkBufferMemoryBarrier &barrier);
+    void add_barrier(VkPipelineStageFlags src, VkPipelineStageFlags dst, const VkImageMemoryBarrier &barrier);
+    void flush_barriers();
+
     inline VkCommandBuffer cmdbuf() const { return command_buffer_; }
 private:
     VkCommandBuffer command_buffer_;
 
-    // TODO: Resource tracking for barriers etc...
+    VkPipelineStageFlags src_stages_;
+    VkPipelineStageFlags dst_stages_;
+
+    VkBufferMemoryBarrier *buffer_barriers_;
+    u32 buffer_barrier_count_;
+    u32 buffer_barrier_capacity_;
+
+    VkImageMemoryBarrier *image_barriers_;
+    u32 image_barrier_count_;
+    u32 image_barrier_capacity_;
 
     friend class compute_pass;
     friend class texture;
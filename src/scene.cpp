@@ -0,0 +1,108 @@
+#include "log.hpp"
+#include "scene.hpp"
+
+bool open_scene(const std::string &path, scene *result) {
+    // Validation only touches the header, the blobs get read front to back by the upload
+    result->file = mapped_file(path, map_hint_sequential);
+
+    if (!result->file.is_open()) {
+        return false;
+    }
+
+    if (result->file.size() < sizeof(scene_header)) {
+        log_error("Scene %s is too small to hold a header", path.c_str());
+        return false;
+    }
+
+    const scene_header *header = result->file.view<scene_header>(0, 1).data;
+
+    if (header->magic != scene_magic) {
+        log_error("%s is not a scene file", path.c_str());
+        return false;
+    }
+
+    // Version 2 only lacks the CSG tree, its pad is zero where the tree would be
+    bool is_known_version = header->version == scene_version || header->version == 2;
+    if (!is_known_version || header->blob_size != sizeof(blob)) {
+        log_error("Scene %s has version %u (blob size %u), expected version %u (blob size %u)",
+            path.c_str(), header->version, header->blob_size, scene_version, (u32)sizeof(blob));
+        return false;
+    }
+
+    u64 blob_end = (u64)header->blob_offset + (u64)header->blob_count * sizeof(blob);
+    if (header->blob_offset % 16 || header->add_count > header->blob_count || blob_end > result->file.size()) {
+        log_error("Scene %s has an invalid blob section", path.c_str());
+        return false;
+    }
+
+    u32 csg_node_count = header->version == 2 ? 0 : header->csg_node_count;
+    u64 csg_end = (u64)header->csg_offset + (u64)csg_node_count * sizeof(csg_node);
+    if (csg_node_count && (header->csg_offset % 16 || csg_end > result->file.size())) {
+        log_error("Scene %s has an invalid CSG section", path.c_str());
+        return false;
+    }
+
+    result->header = header;
+    result->blobs = result->file.view<blob>(header->blob_offset, header->blob_count);
+
+    if (csg_node_count) {
+        result->csg_nodes = result->file.view<csg_node>(header->csg_offset, csg_node_count);
+
+        // Children before parents, so the compiler never follows a cycle
+        for (u32 i = 0; i < csg_node_count; ++i) {
+            const csg_node &node = result->csg_nodes[i];
+            bool is_valid = node.op == csg_op_leaf ?
+                node.left < header->blob_count || node.left == csg_no_blob :
+                node.op <= sdf_smooth_intersect && node.left < i && node.right < i;
+
+            if (!is_valid) {
+                log_error("Scene %s has an invalid CSG node %u", path.c_str(), i);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void save_scene(const std::string &path, const blob *blobs, u32 count, u32 add_count,
+    const csg_node *csg_nodes, u32 csg_node_count) {
+    scene_header header = {};
+    header.magic = scene_magic;
+    header.version = scene_version;
+    header.blob_size = sizeof(blob);
+    header.blob_count = count;
+    header.add_count = add_count;
+    header.blob_offset = sizeof(scene_header);
+    // Blobs are 64 bytes, the tree stays aligned right behind them
+    header.csg_node_count = csg_node_count;
+    header.csg_offset = csg_node_count ? header.blob_offset + count * sizeof(blob) : 0;
+
+    file output(path, file_type_bin | file_type_out | file_type_trunc);
+    output.write(&header, sizeof(header));
+    output.write(blobs, count * sizeof(blob));
+    output.write(csg_nodes, csg_node_count * sizeof(csg_node));
+
+    log_info("Saved %u blobs to %s", count, path.c_str());
+}
+
+// Blobs and nodes are whole words, a word at a time is plenty to tell scenes apart
+static u64 hash_words_(u64 hash, const void *data, u64 size) {
+    const u8 *bytes = (const u8 *)data;
+
+    for (u64 i = 0; i + sizeof(u64) <= size; i += sizeof(u64)) {
+        u64 word;
+        memcpy(&word, bytes + i, sizeof(u64));
+        hash = (hash ^ word) * 0x100000001b3ull;
+        hash ^= hash >> 32;
+    }
+
+    return hash;
+}
+
+u64 hash_scene(const blob *blobs, u32 count, u32 add_count, const csg_node *csg_nodes, u32 csg_node_count) {
+    u64 hash = 0xcbf29ce484222325ull ^ ((u64)count << 32 | add_count);
+    hash = hash_words_(hash, blobs, (u64)count * sizeof(blob));
+    hash = hash_words_(hash, csg_nodes, (u64)csg_node_count * sizeof(csg_node));
+    return hash;
+}
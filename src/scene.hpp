@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+
+#include "csg.hpp"
+#include "blob.hpp"
+#include "file.hpp"
+#include "types.hpp"
+
+/* Binary scene files (.mscn). Everything is little-endian:
+ *
+ *   scene_header
+ *   blob[blob_count] at blob_offset - exactly the GPU blob layout, additions
+ *                    first, then subtractions (like the blob storage buffer)
+ *   csg_node[csg_node_count] at csg_offset - optional CSG tree (csg.hpp),
+ *                    leaves refer to blobs by index. Without one the blobs
+ *                    combine by their ops. Version 2 files never have one
+ *
+ * Loading a scene is mapping the file and copying the blob section into the
+ * staging ring, nothing gets parsed or converted per blob. */
+
+// "MSCN"
+constexpr u32 scene_magic = 0x4e43534d;
+constexpr u32 scene_version = 3;
+
+struct scene_header {
+    u32 magic;
+    u32 version;
+    // sizeof(blob) of the writer, files with another layout are rejected
+    u32 blob_size;
+    u32 blob_count;
+    u32 add_count;
+    // From the start of the file, 16 byte aligned
+    u32 blob_offset;
+    u32 csg_node_count;
+    // From the start of the file, 16 byte aligned
+    u32 csg_offset;
+};
+
+static_assert(sizeof(scene_header) == 32, "scene_header is part of the file format");
+
+#if defined(__BYTE_ORDER__)
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Scene files are read in place, the host has to be little-endian");
+#endif
+
+struct scene {
+    scene()
+    : header(nullptr), blobs(nullptr, 0), csg_nodes(nullptr, 0) {
+
+    }
+
+    mapped_file file;
+    const scene_header *header;
+    // Point into the mapping
+    buffer<const blob> blobs;
+    buffer<const csg_node> csg_nodes;
+};
+
+// Maps and validates the file, logs and returns false if it can't be used
+bool open_scene(const std::string &path, scene *result);
+void save_scene(const std::string &path, const blob *blobs, u32 count, u32 add_count,
+    const csg_node *csg_nodes, u32 csg_node_count);
+// Over everything save_scene writes, journals remember the scene they apply to by it
+u64 hash_scene(const blob *blobs, u32 count, u32 add_count, const csg_node *csg_nodes, u32 csg_node_count);
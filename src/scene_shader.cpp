@@ -0,0 +1,428 @@
+#include "log.hpp"
+#include "sim.hpp"
+#include "file.hpp"
+#include "scene_shader.hpp"
+#include "core_render.hpp"
+
+#include <thread>
+#include <atomic>
+#include <stdio.h>
+#include <glm/gtc/packing.hpp>
+
+#ifdef MIRAGE_HAS_SHADERC
+#include <shaderc/shaderc.h>
+#endif
+
+// Dragging a blob around would otherwise start a build every tick
+static constexpr u32 quiet_tick_count_ = (u32)(sim_tick_rate / 4.0f);
+// More than core_render keeps in flight, a replaced pass can't be used by any of them after that
+static constexpr u32 retire_frame_count_ = 3;
+
+// Simulation side. Versions start at 1, the render side hasn't seen a source for 0
+static u64 scene_version_ = 1;
+static u32 quiet_ticks_;
+static bool is_scene_map_written_;
+
+static compute_pass pass_;
+static u64 pass_version_;
+static bool is_pass_ready_;
+
+#ifdef MIRAGE_HAS_SHADERC
+
+// Render side: the build running in the background
+static std::thread build_thread_;
+static std::atomic<bool> is_build_done_;
+static bool is_building_;
+static std::string build_source_;
+static u64 build_version_;
+static heap_array<u32> build_spirv_;
+
+// The newest source which didn't get built yet
+static std::string pending_source_;
+static u64 pending_version_;
+static bool has_pending_source_;
+
+static compute_pass retired_pass_;
+static u32 retired_frames_;
+
+// Always a float literal, ints don't convert everywhere GLSL expects a float
+static void append_float_(std::string &out, f32 value) {
+    char str[32];
+    snprintf(str, sizeof(str), "%.9g", value);
+    out += str;
+
+    if (!strpbrk(str, ".eEn")) {
+        out += ".0";
+    }
+}
+
+static void append_vec3_(std::string &out, const v3 &v) {
+    out += "vec3(";
+    append_float_(out, v.x);
+    out += ", ";
+    append_float_(out, v.y);
+    out += ", ";
+    append_float_(out, v.z);
+    out += ")";
+}
+
+// Same as blob_distance in blob_map.glsl with the blob's parameters as constants
+static void append_blob_distance_(std::string &out, u32 idx, bool is_dynamic_inlined) {
+    blob b = get_blob(get_blob_handle(idx));
+
+    if ((b.flags & blob_flag_dynamic) && !is_dynamic_inlined) {
+        out += "blob_distance(ublobs.blobs[" + std::to_string(idx) + "], pos)";
+        return;
+    }
+
+    switch (b.type) {
+    case sdf_sphere: {
+        out += "sphere(pos - ";
+        append_vec3_(out, v3(b.position));
+        out += ", ";
+        append_float_(out, b.scale.w);
+        out += ")";
+    } break;
+
+    case sdf_cube: {
+        // inverse_rotate as a matrix: the transpose of the rotation, both sides are column major
+        glm::mat3 inverse = glm::transpose(glm::mat3_cast(q4(b.rotation.w, b.rotation.x, b.rotation.y, b.rotation.z)));
+
+        out += "cube(mat3(";
+        for (u32 i = 0; i < 9; ++i) {
+            append_float_(out, inverse[i / 3][i % 3]);
+            out += i < 8 ? ", " : "";
+        }
+        out += ") * (pos - ";
+        append_vec3_(out, v3(b.position));
+        out += "), ";
+        append_vec3_(out, v3(b.scale));
+        out += ", ";
+        append_float_(out, b.scale.w);
+        out += ")";
+    } break;
+
+    default: out += "1e10"; break;
+    }
+}
+
+// Blob idx only gets evaluated when its bounding sphere is closer than bound (see is_sphere_beyond)
+static void append_bound_check_(std::string &out, u32 idx, const std::string &bound) {
+    blob b = get_blob(get_blob_handle(idx));
+
+    out += "    if (!is_sphere_beyond(pos, ";
+    append_vec3_(out, v3(b.position));
+    out += ", ";
+    append_float_(out, b.position.w);
+    out += ", " + bound + ")) ";
+}
+
+// The fixed pattern of blob_map.glsl: every addition, then every subtraction
+static void append_blob_pattern_(std::string &out) {
+    const blob_list_header &header = ggfx->blobs->header;
+
+    out += "    float d = 1e10;\n";
+    for (u32 i = 0; i < header.count; ++i) {
+        bool is_add = i < header.add_count;
+
+        if (get_blob(get_blob_handle(i)).flags & blob_flag_dynamic) {
+            out += is_add ? "    d = add_blob(" : "    d = sub_blob(";
+            out += "ublobs.blobs[" + std::to_string(i) + "], pos, d);\n";
+            continue;
+        }
+
+        append_bound_check_(out, i, is_add ? "d + blob_smoothing" : "blob_smoothing - d");
+        out += is_add ? "d = op_smooth_union(" : "d = op_smooth_sub(";
+        append_blob_distance_(out, i, false);
+        out += ", d, blob_smoothing);\n";
+    }
+
+    out += "    return d;\n";
+}
+
+// Every instruction of the program as a line of its own (see csg.glsl), with the registers as locals
+static bool append_csg_program_(std::string &out) {
+    const small_vector<csg_node, 16> &csg = ggfx->blobs->csg;
+
+    csg_program program;
+    if (!compile_csg(csg.data(), csg.size(), program)) {
+        return false;
+    }
+
+    if (program.code.empty()) {
+        out += "    return 1e10;\n";
+        return true;
+    }
+
+    for (u32 i = 0; i < program.register_count; ++i) {
+        out += "    float r" + std::to_string(i) + ";\n";
+    }
+
+    for (u32 i = 0; i < program.code.size(); ++i) {
+        const csg_instruction &instruction = program.code[i];
+        u32 code = instruction.code;
+
+        u32 opcode = code & 0x7;
+        std::string dst = "r" + std::to_string((code >> 3) & 0xf);
+        std::string a = "r" + std::to_string((code >> 7) & 0xf);
+
+        std::string b;
+        if (opcode == csg_load || (code & csg_code_blob_operand)) {
+            // Any change to the blobs recompiles the program, so even the dynamic ones are constants here
+            append_blob_distance_(b, instruction.blob, true);
+        }
+        else {
+            b = "r" + std::to_string((code >> 11) & 0xf);
+        }
+
+        std::string k;
+        append_float_(k, glm::unpackHalf1x16((u16)(code >> 16)));
+
+        // The blob operands of unions and subtractions can be skipped like in csg.glsl, dst is a for them
+        bool is_blob_operand = opcode != csg_load && (code & csg_code_blob_operand);
+        switch (is_blob_operand ? opcode : csg_load) {
+        case csg_union: append_bound_check_(out, instruction.blob, a); break;
+        case csg_sub: append_bound_check_(out, instruction.blob, "-" + a); break;
+        case csg_smooth_union: append_bound_check_(out, instruction.blob, a + " + " + k); break;
+        case csg_smooth_sub: append_bound_check_(out, instruction.blob, k + " - " + a); break;
+        default: out += "    "; break;
+        }
+
+        out += dst + " = ";
+        switch (opcode) {
+        case csg_load: out += b; break;
+        case csg_union: out += "op_union(" + a + ", " + b + ")"; break;
+        case csg_sub: out += "op_sub(" + b + ", " + a + ")"; break;
+        case csg_intersect: out += "op_intersect(" + a + ", " + b + ")"; break;
+        case csg_smooth_union: out += "op_smooth_union(" + a + ", " + b + ", " + k + ")"; break;
+        case csg_smooth_sub: out += "op_smooth_sub(" + b + ", " + a + ", " + k + ")"; break;
+        case csg_smooth_intersect: out += "op_smooth_intersect(" + a + ", " + b + ", " + k + ")"; break;
+        default: out += a; break;
+        }
+        out += ";\n";
+    }
+
+    out += "    return r" + std::to_string(program.result_register) + ";\n";
+    return true;
+}
+
+static void generate_scene_map_(std::string &out) {
+    out = "// Generated by scene_shader.cpp for scene version " + std::to_string(scene_version_) + "\n";
+    out += "float scene_map(in vec3 pos) {\n";
+
+    // A tree which doesn't compile renders as the fixed pattern, same as in blob_cast
+    std::string program;
+    if (!ggfx->blobs->csg.empty() && append_csg_program_(program)) {
+        out += program;
+    }
+    else {
+        append_blob_pattern_(out);
+    }
+
+    out += "}\n";
+}
+
+#endif
+
+void write_scene_map(blob_snapshot &snapshot, bool is_scene_changed) {
+    snapshot.scene_map.clear();
+
+    if (is_scene_changed) {
+        ++scene_version_;
+        quiet_ticks_ = 0;
+        is_scene_map_written_ = false;
+    }
+    else if (quiet_ticks_ < quiet_tick_count_) {
+        ++quiet_ticks_;
+    }
+
+    snapshot.scene_version = scene_version_;
+
+#ifdef MIRAGE_HAS_SHADERC
+    if (is_scene_map_written_ || quiet_ticks_ < quiet_tick_count_) {
+        return;
+    }
+
+    // Tried once per version, whether it worked or not
+    is_scene_map_written_ = true;
+
+    if (ggfx->blobs->header.count <= scene_shader_max_blobs) {
+        generate_scene_map_(snapshot.scene_map);
+    }
+#endif
+}
+
+void fold_scene_map(const blob_snapshot &snapshot) {
+    // The render thread never saw the source, the next snapshot brings it again
+    if (!snapshot.scene_map.empty() && snapshot.scene_version == scene_version_) {
+        is_scene_map_written_ = false;
+    }
+}
+
+#ifdef MIRAGE_HAS_SHADERC
+
+// An #include the compiler asked for, scene_map.glsl comes from memory and the rest from res/glsl
+struct include_file_ {
+    shaderc_include_result result;
+    std::string name;
+    mapped_file file;
+};
+
+static std::string make_glsl_path_(const char *name) {
+    return std::string(MIRAGE_PROJECT_ROOT) + "/res/glsl/" + name;
+}
+
+static shaderc_include_result *resolve_include_(void *, const char *requested, int, const char *, size_t) {
+    include_file_ *include = mem_alloc<include_file_>();
+    include->name = requested;
+    include->result.user_data = include;
+
+    if (include->name == "scene_map.glsl") {
+        include->result.content = build_source_.data();
+        include->result.content_length = build_source_.size();
+    }
+    else {
+        include->file = mapped_file(make_glsl_path_(requested), map_hint_sequential);
+        if (!include->file.is_open()) {
+            // An empty name is how shaderc tells the include failed, the content becomes the message
+            static const char *message = "Failed to open the include";
+            include->result.source_name = "";
+            include->result.source_name_length = 0;
+            include->result.content = message;
+            include->result.content_length = strlen(message);
+            return &include->result;
+        }
+
+        include->result.content = (const char *)include->file.bytes().data;
+        include->result.content_length = include->file.size();
+    }
+
+    include->result.source_name = include->name.c_str();
+    include->result.source_name_length = include->name.size();
+    return &include->result;
+}
+
+static void release_include_(void *, shaderc_include_result *result) {
+    mem_free((include_file_ *)result->user_data);
+}
+
+// blob_cast.comp with MIRAGE_SCENE_MAP, an empty result when it didn't compile
+static void build_thread_proc_() {
+    build_spirv_ = heap_array<u32>();
+
+    mapped_file src_file(make_glsl_path_("blob_cast.comp"), map_hint_sequential);
+    if (!src_file.is_open()) {
+        is_build_done_.store(true, std::memory_order_release);
+        return;
+    }
+
+    shaderc_compiler_t compiler = shaderc_compiler_initialize();
+    shaderc_compile_options_t options = shaderc_compile_options_initialize();
+    shaderc_compile_options_set_target_env(options, shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+    shaderc_compile_options_set_optimization_level(options, shaderc_optimization_level_performance);
+    shaderc_compile_options_add_macro_definition(options, "MIRAGE_SCENE_MAP", strlen("MIRAGE_SCENE_MAP"), nullptr, 0);
+    shaderc_compile_options_set_include_callbacks(options, &resolve_include_, &release_include_, nullptr);
+
+    std::string_view src = src_file.text();
+    shaderc_compilation_result_t result = shaderc_compile_into_spv(compiler, src.data(), src.size(),
+        shaderc_compute_shader, "blob_cast.comp", "main", options);
+
+    if (shaderc_result_get_compilation_status(result) == shaderc_compilation_status_success) {
+        build_spirv_ = heap_array<u32>((const u32 *)shaderc_result_get_bytes(result), shaderc_result_get_length(result) / sizeof(u32));
+    }
+    else {
+        log_error("Failed to compile the scene shader: %s", shaderc_result_get_error_message(result));
+    }
+
+    shaderc_result_release(result);
+    shaderc_compile_options_release(options);
+    shaderc_compiler_release(compiler);
+
+    is_build_done_.store(true, std::memory_order_release);
+}
+
+static void start_build_() {
+    build_source_ = std::move(pending_source_);
+    build_version_ = pending_version_;
+    has_pending_source_ = false;
+
+    is_building_ = true;
+    is_build_done_.store(false, std::memory_order_relaxed);
+    build_thread_ = std::thread(&build_thread_proc_);
+}
+
+/* Pipelines get created here on the render thread, the descriptor set
+ * layout cache isn't thread safe. The old pass may still be used by frames
+ * in flight, it only goes away a few frames later. */
+static void finish_build_() {
+    build_thread_.join();
+    is_building_ = false;
+
+    if (!build_spirv_.size()) {
+        return;
+    }
+
+    if (is_pass_ready_) {
+        if (retired_frames_) {
+            // Two swaps within a few frames, rare enough to just wait
+            vkDeviceWaitIdle(gctx->device);
+            retired_pass_.destroy();
+        }
+
+        retired_pass_ = std::move(pass_);
+        retired_frames_ = retire_frame_count_;
+    }
+
+    pass_ = make_blob_cast_pass(buffer<const u32>(build_spirv_.data(), build_spirv_.size()));
+    pass_version_ = build_version_;
+    is_pass_ready_ = true;
+    build_spirv_ = heap_array<u32>();
+}
+
+#endif
+
+void update_scene_shader() {
+#ifdef MIRAGE_HAS_SHADERC
+    if (retired_frames_ && --retired_frames_ == 0) {
+        retired_pass_.destroy();
+    }
+
+    const blob_snapshot *snapshot = ggfx->blob_view;
+    if (!snapshot) {
+        return;
+    }
+
+    // Only the newest source matters, anything older is stale by now
+    if (!snapshot->scene_map.empty() && snapshot->scene_version != pending_version_) {
+        pending_source_ = snapshot->scene_map;
+        pending_version_ = snapshot->scene_version;
+        has_pending_source_ = true;
+    }
+
+    if (is_building_ && is_build_done_.load(std::memory_order_acquire)) {
+        finish_build_();
+    }
+
+    if (!is_building_ && has_pending_source_) {
+        start_build_();
+    }
+#endif
+}
+
+compute_pass *get_scene_shader_pass() {
+    const blob_snapshot *snapshot = ggfx->blob_view;
+    if (!is_pass_ready_ || !snapshot || snapshot->scene_version != pass_version_) {
+        return nullptr;
+    }
+
+    return &pass_;
+}
+
+void shutdown_scene_shader() {
+#ifdef MIRAGE_HAS_SHADERC
+    if (is_building_) {
+        build_thread_.join();
+        is_building_ = false;
+    }
+#endif
+}
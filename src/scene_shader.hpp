@@ -0,0 +1,32 @@
+#pragma once
+
+#include "blob.hpp"
+#include "types.hpp"
+#include "compute.hpp"
+
+/* blob_cast specialized for the current scene: the field gets generated as
+ * straight-line GLSL (scene_map.glsl, every blob's parameters inlined as
+ * constants, no BVH walk, no loops), which blob_cast.comp evaluates instead
+ * of the generic map when it's compiled with MIRAGE_SCENE_MAP. Compiling
+ * takes a while, so it runs on a thread of its own once the scene stopped
+ * changing, and the generic blob_cast renders until the result is ready.
+ * Only available when the build found shaderc (MIRAGE_HAS_SHADERC). */
+
+// Past this the BVH walk evaluates fewer blobs than the unrolled field would
+constexpr u32 scene_shader_max_blobs = 64;
+
+/* Simulation thread. is_scene_changed: something the inlined constants can't
+ * follow changed this tick (dynamic blobs are read from blob_data, so they
+ * can keep moving). Puts the source into the snapshot once the scene has
+ * been quiet for a bit. */
+void write_scene_map(blob_snapshot &snapshot, bool is_scene_changed);
+void fold_scene_map(const blob_snapshot &snapshot);
+
+// Render thread, after update_blobs. Starts builds and swaps in finished ones
+void update_scene_shader();
+// The pass for the blobs the render thread sees, nullptr when the generic one has to run
+compute_pass *get_scene_shader_pass();
+void shutdown_scene_shader();
+
+// final_pass.cpp: blob_cast's resources around the given SPIR-V
+compute_pass make_blob_cast_pass(buffer<const u32> spirv);
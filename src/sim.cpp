@@ -0,0 +1,218 @@
+#include "sim.hpp"
+#include "log.hpp"
+#include "jobs.hpp"
+#include "mpsc_ring.hpp"
+
+#include <chrono>
+#include <thread>
+
+using sim_clock_ = std::chrono::steady_clock;
+
+// Jobs kicked by one tick, the allocator gets reset at the start of the next
+static constexpr u32 sim_job_memory_ = 256 * 1024;
+
+/* Triple buffer: the simulation writes into back_, the render thread reads
+ * front_ and middle_ is whichever one got published last. Both sides only
+ * ever swap their own index with middle_, fresh_bit_ tells the render thread
+ * whether there's something it hasn't seen yet. */
+static constexpr u32 fresh_bit_ = 4;
+
+static blob_snapshot snapshots_[3];
+static std::atomic<u32> middle_;
+static u32 back_;
+static u32 front_;
+
+static mpsc_ring<blob_command, blob_command_capacity> commands_;
+static std::atomic<u64> dropped_count_;
+
+// Drained commands of the current tick, the scratch space survives the ticks
+static small_vector<blob_command, 64> tick_commands_;
+static small_vector<u64, 128> coalesce_table_;
+static small_vector<bool, 64> is_dropped_;
+
+static std::thread thread_;
+static std::atomic<bool> is_running_;
+static u64 tick_;
+
+static void apply_command_(const blob_command &command) {
+    switch (command.type) {
+    case blob_command_add: add_blob(command.value); break;
+    case blob_command_move: move_blob(command.handle, v3(command.value.position)); break;
+    case blob_command_delete: delete_blob(command.handle); break;
+    case blob_command_delete_last: delete_last_blob(); break;
+    case blob_command_undo: undo_blob_edit(); break;
+    case blob_command_save: save_blobs(); break;
+    }
+}
+
+// Only ever called by one thread at a time (the simulation, or stop_sim after joining it)
+static void drain_commands_() {
+    commands_.drain([] (const blob_command &command) {
+        tick_commands_.push_back(command);
+    });
+}
+
+static u64 handle_key_(blob_handle handle) {
+    // Never 0, live handles have a generation
+    return ((u64)handle.generation << 32) | handle.slot;
+}
+
+/* Within a run of moves, moves of different blobs commute, so only the last
+ * move of each blob has to be kept. Anything else ends the run, moves never
+ * get reordered across an add, delete or undo. Runs are scanned backwards
+ * through a small hash set of the handles already seen. */
+static void coalesce_moves_(u32 begin, u32 end, bool *is_dropped) {
+    u32 table_size = 16;
+    while (table_size < (end - begin) * 2) {
+        table_size *= 2;
+    }
+
+    coalesce_table_.resize(table_size);
+    zero_memory(table_size, coalesce_table_.data());
+
+    for (u32 i = end; i-- > begin;) {
+        u64 key = handle_key_(tick_commands_[i].handle);
+        u32 bucket = (u32)((key * 0x9e3779b97f4a7c15ull) >> 40) & (table_size - 1);
+
+        while (coalesce_table_[bucket] && coalesce_table_[bucket] != key) {
+            bucket = (bucket + 1) & (table_size - 1);
+        }
+
+        is_dropped[i] = coalesce_table_[bucket] == key;
+        coalesce_table_[bucket] = key;
+    }
+}
+
+static void apply_commands_() {
+    u32 count = tick_commands_.size();
+    if (!count) {
+        return;
+    }
+
+    is_dropped_.resize(count);
+    bool *is_dropped = is_dropped_.data();
+    zero_memory(count, is_dropped);
+
+    u32 run_begin = 0;
+    for (u32 i = 0; i <= count; ++i) {
+        if (i == count || tick_commands_[i].type != blob_command_move) {
+            if (i - run_begin > 1) {
+                coalesce_moves_(run_begin, i, is_dropped);
+            }
+
+            run_begin = i + 1;
+        }
+    }
+
+    for (u32 i = 0; i < count; ++i) {
+        if (!is_dropped[i]) {
+            apply_command_(tick_commands_[i]);
+        }
+    }
+
+    tick_commands_.clear();
+}
+
+/* A published snapshot the render thread hasn't picked up yet gets taken
+ * back first and folded into the store, so the one written now carries its
+ * changes too. If the render thread is faster, the swap fails and it simply
+ * has consumed it. */
+static void publish_snapshot_(f32 sim_ms) {
+    u32 middle = middle_.load(std::memory_order_acquire);
+    if ((middle & fresh_bit_) && middle_.compare_exchange_strong(middle, back_, std::memory_order_acq_rel)) {
+        back_ = middle & ~fresh_bit_;
+        fold_blob_snapshot(snapshots_[back_]);
+    }
+
+    blob_snapshot &snapshot = snapshots_[back_];
+    snapshot.tick = tick_;
+    snapshot.sim_ms = sim_ms;
+    write_blob_snapshot(snapshot);
+
+    // Only this thread ever sets fresh_bit_, so what comes back has been seen
+    back_ = middle_.exchange(back_ | fresh_bit_, std::memory_order_acq_rel) & ~fresh_bit_;
+}
+
+static void sim_proc_() {
+    attach_job_thread(sim_job_memory_);
+
+    const sim_clock_::duration tick_length = std::chrono::duration_cast<sim_clock_::duration>(
+        std::chrono::duration<f64>(1.0 / sim_tick_rate));
+
+    sim_clock_::time_point start = sim_clock_::now();
+    sim_clock_::time_point next_tick = start + tick_length;
+
+    while (is_running_.load(std::memory_order_acquire)) {
+        sim_clock_::time_point tick_start = sim_clock_::now();
+        reset_attached_job_allocator();
+
+        drain_commands_();
+        apply_commands_();
+
+        ++tick_;
+        tick_blobs((f32)tick_ / sim_tick_rate);
+
+        f32 sim_ms = std::chrono::duration<f32, std::milli>(sim_clock_::now() - tick_start).count();
+        publish_snapshot_(sim_ms);
+
+        // Fixed rate, a tick that ran long doesn't get made up for
+        std::this_thread::sleep_until(next_tick);
+        next_tick += tick_length;
+        if (next_tick < sim_clock_::now()) {
+            next_tick = sim_clock_::now() + tick_length;
+        }
+    }
+}
+
+void start_sim() {
+    back_ = 0;
+    middle_.store(1, std::memory_order_relaxed);
+    front_ = 2;
+    tick_ = 0;
+
+    // Whatever init_blobs left dirty is there for the very first frame
+    publish_snapshot_(0.0f);
+
+    is_running_.store(true, std::memory_order_release);
+    thread_ = std::thread(&sim_proc_);
+}
+
+void stop_sim() {
+    if (!is_running_.exchange(false)) {
+        return;
+    }
+
+    thread_.join();
+
+    // Edits which never got ticked still belong in the journal
+    drain_commands_();
+    apply_commands_();
+}
+
+bool submit_blob_command(const blob_command &command) {
+    bool is_pushed = commands_.push([&command] (blob_command &slot) {
+        slot = command;
+    });
+
+    // Full, the caller decides whether to retry
+    if (!is_pushed) {
+        dropped_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return is_pushed;
+}
+
+u64 get_dropped_blob_command_count() {
+    return dropped_count_.load(std::memory_order_relaxed);
+}
+
+blob_snapshot *consume_blob_snapshot() {
+    if (!(middle_.load(std::memory_order_relaxed) & fresh_bit_)) {
+        return nullptr;
+    }
+
+    u32 previous = middle_.exchange(front_, std::memory_order_acq_rel);
+    front_ = previous & ~fresh_bit_;
+
+    return &snapshots_[front_];
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "blob.hpp"
+
+/* The blob store is owned by a simulation thread ticking at a fixed rate,
+ * decoupled from the frame rate. Every tick ends with a snapshot of what
+ * changed, handed to the render thread through a triple buffer: neither
+ * side ever waits on the other, the render thread simply picks up the
+ * newest snapshot whenever it's done with the previous one.
+ *
+ * Everything else (the overlay, tools, scripting threads) talks to the store
+ * through commands: a bounded lock-free queue which the simulation drains at
+ * the start of every tick. Moves of the same blob within a burst get
+ * coalesced, only the last one is applied and journaled. */
+
+constexpr f32 sim_tick_rate = 120.0f;
+constexpr u32 blob_command_capacity = 4096;
+
+enum blob_command_type : u32 {
+    blob_command_add,
+    blob_command_move,
+    blob_command_delete,
+    // Resolved on the simulation thread, the render side only knows the count
+    blob_command_delete_last,
+    blob_command_undo,
+    blob_command_save
+};
+
+struct blob_command {
+    blob_command_type type;
+    blob_handle handle;
+    blob value;
+};
+
+// Publishes the initial snapshot and starts ticking, the store has to be loaded
+void start_sim();
+void stop_sim();
+
+// Can be called from any thread and never blocks, gets applied at the start
+// of the next tick. False when the queue is full and the command got dropped
+bool submit_blob_command(const blob_command &command);
+u64 get_dropped_blob_command_count();
+
+// Render thread: the newest snapshot if there is one it hasn't seen yet. It
+// stays valid until the next call which returns something else
+blob_snapshot *consume_blob_snapshot();
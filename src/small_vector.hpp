@@ -0,0 +1,190 @@
+#pragma once
+
+#include <utility>
+#include "types.hpp"
+#include "memory.hpp"
+
+// Growable array which keeps up to N elements inline and only goes to the
+// heap once it outgrows them. Elements are constructed in place by
+// emplace_back and moved (never copied) when the storage grows
+template <typename T, u32 N>
+class small_vector {
+public:
+    small_vector()
+    : data_((T *)inline_), size_(0), capacity_(N) {
+
+    }
+
+    small_vector(const small_vector &other)
+    : small_vector() {
+        reserve(other.size_);
+        for (u32 i = 0; i < other.size_; ++i) {
+            new(&data_[i]) T(other.data_[i]);
+        }
+        size_ = other.size_;
+    }
+
+    small_vector(small_vector &&other)
+    : small_vector() {
+        steal_(other);
+    }
+
+    small_vector &operator=(const small_vector &other) {
+        if (this != &other) {
+            clear();
+            reserve(other.size_);
+            for (u32 i = 0; i < other.size_; ++i) {
+                new(&data_[i]) T(other.data_[i]);
+            }
+            size_ = other.size_;
+        }
+
+        return *this;
+    }
+
+    small_vector &operator=(small_vector &&other) {
+        if (this != &other) {
+            clear();
+            release_heap_();
+            steal_(other);
+        }
+
+        return *this;
+    }
+
+    ~small_vector() {
+        clear();
+        release_heap_();
+    }
+
+    void reserve(u32 capacity) {
+        if (capacity <= capacity_) {
+            return;
+        }
+
+        relocate_((T *)mem_alloc_raw(sizeof(T) * capacity, alignof(T)), capacity);
+    }
+
+    template <typename ...Args>
+    T &emplace_back(Args &&...args) {
+        if (size_ < capacity_) {
+            return *new(&data_[size_++]) T(std::forward<Args>(args)...);
+        }
+
+        // args can refer to one of our own elements (push_back(v[0])), so the
+        // new element gets built before the old storage goes away
+        u32 capacity = capacity_ * 2;
+        T *new_data = (T *)mem_alloc_raw(sizeof(T) * capacity, alignof(T));
+        new(&new_data[size_]) T(std::forward<Args>(args)...);
+
+        relocate_(new_data, capacity);
+        return data_[size_++];
+    }
+
+    void push_back(const T &item) { emplace_back(item); }
+    void push_back(T &&item) { emplace_back(std::move(item)); }
+
+    void pop_back() {
+        data_[--size_].~T();
+    }
+
+    // Moves the last element into index, order is not preserved
+    void swap_remove(u32 index) {
+        if (index != size_ - 1) {
+            data_[index].~T();
+            new(&data_[index]) T(std::move(data_[size_ - 1]));
+        }
+
+        pop_back();
+    }
+
+    void resize(u32 size) {
+        reserve(size);
+
+        for (u32 i = size_; i < size; ++i) {
+            new(&data_[i]) T;
+        }
+
+        for (u32 i = size; i < size_; ++i) {
+            data_[i].~T();
+        }
+
+        size_ = size;
+    }
+
+    void clear() {
+        for (u32 i = 0; i < size_; ++i) {
+            data_[i].~T();
+        }
+
+        size_ = 0;
+    }
+
+    // Helpers
+    u32 size() const { return size_; }
+    u32 capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+    bool is_inline() const { return data_ == (T *)inline_; }
+    T *data() { return data_; }
+    const T *data() const { return data_; }
+
+    T &back() { return data_[size_ - 1]; }
+    const T &back() const { return data_[size_ - 1]; }
+
+    // Iteration
+    T &operator[](u32 index) { return data_[index]; }
+    const T &operator[](u32 index) const { return data_[index]; }
+
+    T *begin() { return data_; }
+    T *end() { return data_ + size_; }
+    const T *begin() const { return data_; }
+    const T *end() const { return data_ + size_; }
+
+private:
+    // Moves the elements over to new_data and takes it as the storage
+    void relocate_(T *new_data, u32 capacity) {
+        for (u32 i = 0; i < size_; ++i) {
+            new(&new_data[i]) T(std::move(data_[i]));
+            data_[i].~T();
+        }
+
+        release_heap_();
+
+        data_ = new_data;
+        capacity_ = capacity;
+    }
+
+    void release_heap_() {
+        if (!is_inline()) {
+            mem_free_raw(data_, sizeof(T) * capacity_, alignof(T));
+            data_ = (T *)inline_;
+            capacity_ = N;
+        }
+    }
+
+    // Expects this to be empty and inline
+    void steal_(small_vector &other) {
+        if (other.is_inline()) {
+            for (u32 i = 0; i < other.size_; ++i) {
+                new(&data_[i]) T(std::move(other.data_[i]));
+            }
+            size_ = other.size_;
+            other.clear();
+        }
+        else {
+            data_ = other.data_;
+            size_ = other.size_;
+            capacity_ = other.capacity_;
+
+            other.data_ = (T *)other.inline_;
+            other.size_ = 0;
+            other.capacity_ = N;
+        }
+    }
+
+private:
+    T *data_;
+    u32 size_;
+    u32 capacity_;
+    alignas(T) u8 inline_[sizeof(T) * N];
+};
@@ -1,5 +1,6 @@
 #include "texture.hpp"
 #include "log.hpp"
+#include "memory.hpp"
 #include "render_context.hpp"
 #include "vulkan/vulkan_core.h"
 
@@ -8,52 +9,64 @@ static constexpr VkImageUsageFlags default_image_usage_flags_ =
     VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
 
 texture::texture() 
-: image_(VK_NULL_HANDLE), image_view_(VK_NULL_HANDLE), descriptor_set_{ VK_NULL_HANDLE }, last_layout_(VK_IMAGE_LAYOUT_UNDEFINED),
-    last_used_(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT), last_used_type_(texture_descriptor_type::max_enum) {
+: image_(VK_NULL_HANDLE), image_view_(VK_NULL_HANDLE), descriptor_set_{ VK_NULL_HANDLE }, levels_(nullptr),
+    base_level_(0), level_count_(0), last_used_type_(texture_descriptor_type::max_enum), is_depth_(false) {
 
 }
 
 texture::texture(VkImage image, VkImageView image_view, bool is_depth) 
-: image_(image), image_view_(image_view), last_used_(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT), is_depth_(is_depth),
-    last_used_type_(texture_descriptor_type::max_enum), last_layout_(VK_IMAGE_LAYOUT_UNDEFINED) {
+: image_(image), image_view_(image_view), last_used_type_(texture_descriptor_type::max_enum), is_depth_(is_depth) {
+    allocate_levels_(1);
+
     // Create descriptor sets
     for (u32 i = 0; i < (u32)texture_descriptor_type::max_enum; ++i) {
-        VkDescriptorSetLayout layout = get_descriptor_set_layout(
-            convert_descriptor_type_((texture_descriptor_type)i), 1);
-
-        VkDescriptorSetAllocateInfo allocate_info = {};
-        allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocate_info.descriptorPool = gctx->descriptor_pool;
-        allocate_info.descriptorSetCount = 1;
-        allocate_info.pSetLayouts = &layout;
-
-        vkAllocateDescriptorSets(
-            gctx->device, &allocate_info, &descriptor_set_[i]);
-
-        VkDescriptorImageInfo image_info = {};
-        VkWriteDescriptorSet write = {};
-
-        image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-        image_info.imageView = image_view_;
-        image_info.sampler = VK_NULL_HANDLE;
-
-        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        write.dstSet = descriptor_set_[i];
-        write.dstBinding = 0;
-        write.dstArrayElement = 0;
-        write.descriptorCount = 1;
-        write.descriptorType = convert_descriptor_type_((texture_descriptor_type)i);
-        write.pImageInfo = &image_info;
-
-        vkUpdateDescriptorSets(gctx->device, 1, &write, 0, nullptr);
+        make_descriptor_set_((texture_descriptor_type)i);
     }
 } 
 
 texture::texture(VkImage image, VkImageView image_view, texture_descriptor_type type, bool is_depth) 
-: image_(image), image_view_(image_view), last_used_(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT), is_depth_(is_depth),
-    last_used_type_(texture_descriptor_type::max_enum), last_layout_(VK_IMAGE_LAYOUT_UNDEFINED) {
+: image_(image), image_view_(image_view), last_used_type_(texture_descriptor_type::max_enum), is_depth_(is_depth) {
+    allocate_levels_(1);
+    make_descriptor_set_(type);
+}
+
+texture::texture(VkImage image, VkImageView image_view, std::initializer_list<texture_descriptor_type> types, bool is_depth) 
+: image_(image), image_view_(image_view), last_used_type_(texture_descriptor_type::max_enum), is_depth_(is_depth) {
+    allocate_levels_(1);
+    for (texture_descriptor_type type : types) {
+        make_descriptor_set_(type);
+    }
+}
+
+texture::texture(VkImage image, VkImageView image_view, std::initializer_list<texture_descriptor_type> types,
+    texture_level_state *levels, u32 base_level, u32 level_count) 
+: image_(image), image_view_(image_view), levels_(levels), base_level_(base_level), level_count_(level_count),
+    last_used_type_(texture_descriptor_type::max_enum), is_depth_(false) {
+    if (!levels_) {
+        allocate_levels_(level_count);
+    }
+
+    for (texture_descriptor_type type : types) {
+        make_descriptor_set_(type);
+    }
+}
+
+// Images live as long as the renderer, so does their state
+void texture::allocate_levels_(u32 level_count) {
+    levels_ = (texture_level_state *)get_persistent_arena().allocate(
+        sizeof(texture_level_state) * level_count, alignof(texture_level_state));
+
+    for (u32 i = 0; i < level_count; ++i) {
+        levels_[i] = { VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_IMAGE_LAYOUT_UNDEFINED };
+    }
+
+    base_level_ = 0;
+    level_count_ = level_count;
+}
+
+void texture::make_descriptor_set_(texture_descriptor_type type) {
     VkDescriptorSetLayout layout = get_descriptor_set_layout(
-        convert_descriptor_type_((texture_descriptor_type)type), 1);
+        convert_descriptor_type_(type), 1);
 
     VkDescriptorSetAllocateInfo allocate_info = {};
     allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
@@ -67,7 +80,9 @@ texture::texture(VkImage image, VkImageView image_view, texture_descriptor_type
     VkDescriptorImageInfo image_info = {};
     VkWriteDescriptorSet write = {};
 
-    image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    // Has to match the layout prepare_compute_resource_ transitions to
+    image_info.imageLayout = type == texture_descriptor_type::storage_image ?
+        VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     image_info.imageView = image_view_;
     image_info.sampler = VK_NULL_HANDLE;
 
@@ -86,6 +101,11 @@ texture &texture::operator=(const texture &other) {
     image_ = other.image_;
     image_view_ = other.image_view_;
     memcpy(descriptor_set_, other.descriptor_set_, sizeof(VkDescriptorSet) * (u32)texture_descriptor_type::max_enum);
+    levels_ = other.levels_;
+    base_level_ = other.base_level_;
+    level_count_ = other.level_count_;
+    last_used_type_ = other.last_used_type_;
+    is_depth_ = other.is_depth_;
 
     return *this;
 }
@@ -116,28 +136,38 @@ VkDescriptorSet *texture::get_descriptor_sets() {
     return descriptor_set_;
 }
 
-void texture::transition_layout(render_graph &graph, VkImageLayout dst, VkPipelineStageFlags stage) {
-    VkImageMemoryBarrier image_barrier = {};
-    image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    image_barrier.srcAccessMask = find_access_flags_for_layout(last_layout_);
-    image_barrier.oldLayout = last_layout_;
-    image_barrier.image = image_;
+void texture::add_level_barriers_(render_graph &graph, VkImageLayout dst, VkPipelineStageFlags stage, bool is_deferred) {
+    for (u32 i = base_level_; i < base_level_ + level_count_; ++i) {
+        texture_level_state &level = levels_[i];
+
+        VkImageMemoryBarrier image_barrier = {};
+        image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        image_barrier.srcAccessMask = find_access_flags_for_layout(level.last_layout);
+        image_barrier.oldLayout = level.last_layout;
+        image_barrier.image = image_;
 
-    image_barrier.newLayout = dst;
-    image_barrier.dstAccessMask = find_access_flags_for_layout(image_barrier.newLayout);
+        image_barrier.newLayout = dst;
+        image_barrier.dstAccessMask = find_access_flags_for_layout(image_barrier.newLayout);
 
-    image_barrier.subresourceRange.aspectMask = is_depth_ ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
-    image_barrier.subresourceRange.baseMipLevel = 0;
-    // For now only support this (will add super soon)
-    image_barrier.subresourceRange.levelCount = 1;
-    image_barrier.subresourceRange.baseArrayLayer = 0;
-    image_barrier.subresourceRange.layerCount = 1;
+        image_barrier.subresourceRange.aspectMask = is_depth_ ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+        image_barrier.subresourceRange.baseMipLevel = i;
+        image_barrier.subresourceRange.levelCount = 1;
+        image_barrier.subresourceRange.baseArrayLayer = 0;
+        image_barrier.subresourceRange.layerCount = 1;
 
-    vkCmdPipelineBarrier(graph.command_buffer_, last_used_, 
-        stage, 0, 0, nullptr, 0, nullptr, 1, &image_barrier);
+        graph.add_barrier(level.last_used, stage, image_barrier);
 
-    last_used_ = stage;
-    last_layout_ = image_barrier.newLayout;
+        level.last_used = stage;
+        level.last_layout = dst;
+    }
+
+    if (!is_deferred) {
+        graph.flush_barriers();
+    }
+}
+
+void texture::transition_layout(render_graph &graph, VkImageLayout dst, VkPipelineStageFlags stage) {
+    add_level_barriers_(graph, dst, stage, false);
 }
 
 void texture::prepare_compute_resource_(render_graph &graph, VkDescriptorType type, void *raw_ptr) {
@@ -145,41 +175,189 @@ void texture::prepare_compute_resource_(render_graph &graph, VkDescriptorType ty
 
     texture_descriptor_type converted_type = (texture_descriptor_type)convert_descriptor_type_vk_(type);
 
-    VkImageMemoryBarrier image_barrier = {};
-    image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    image_barrier.srcAccessMask = find_access_flags_for_layout(ptr->last_layout_);
-    image_barrier.oldLayout = ptr->last_layout_;
-    image_barrier.image = ptr->image_;
-
+    VkImageLayout layout;
     switch (converted_type) {
     case texture_descriptor_type::sampled_image: {
-        image_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     } break;
 
     case texture_descriptor_type::storage_image: {
-        image_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        layout = VK_IMAGE_LAYOUT_GENERAL;
     } break;
 
     case texture_descriptor_type::input_attachment: {
-        image_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     } break;
 
     default: { panic_and_exit(); };
     }
 
-    image_barrier.dstAccessMask = find_access_flags_for_layout(image_barrier.newLayout);
+    // Gets flushed together with the other resources of the dispatch
+    ptr->add_level_barriers_(graph, layout, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, true);
+    ptr->last_used_type_ = converted_type;
+}
+
+texture make_storage_texture(u32 width, u32 height, VkFormat format) {
+    VkImage image;
+    VkImageView image_view;
+
+    VkImageCreateInfo image_info = {};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = format;
+    image_info.extent = { width, height, 1 };
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = default_image_usage_flags_;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VK_CHECK(vkCreateImage(gctx->device, &image_info, nullptr, &image));
+
+    allocate_image_memory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, nullptr);
+
+    VkImageViewCreateInfo image_view_info = {};
+    image_view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    image_view_info.image = image;
+    image_view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    image_view_info.format = format;
+    image_view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_view_info.subresourceRange.baseMipLevel = 0;
+    image_view_info.subresourceRange.levelCount = 1;
+    image_view_info.subresourceRange.baseArrayLayer = 0;
+    image_view_info.subresourceRange.layerCount = 1;
+
+    VK_CHECK(vkCreateImageView(gctx->device, &image_view_info, nullptr, &image_view));
+
+    return texture(image, image_view, texture_descriptor_type::storage_image);
+}
 
-    image_barrier.subresourceRange.aspectMask = ptr->is_depth_ ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
-    image_barrier.subresourceRange.baseMipLevel = 0;
-    // For now only support this (will add super soon)
-    image_barrier.subresourceRange.levelCount = 1;
-    image_barrier.subresourceRange.baseArrayLayer = 0;
-    image_barrier.subresourceRange.layerCount = 1;
+texture make_storage_texture_3d(u32 width, u32 height, u32 depth, VkFormat format, u32 mip_levels) {
+    VkImage image;
+    VkImageView image_view;
+
+    VkImageCreateInfo image_info = {};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_3D;
+    image_info.format = format;
+    image_info.extent = { width, height, depth };
+    image_info.mipLevels = mip_levels;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = default_image_usage_flags_;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VK_CHECK(vkCreateImage(gctx->device, &image_info, nullptr, &image));
+
+    allocate_image_memory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, nullptr);
+
+    VkImageViewCreateInfo image_view_info = {};
+    image_view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    image_view_info.image = image;
+    image_view_info.viewType = VK_IMAGE_VIEW_TYPE_3D;
+    image_view_info.format = format;
+    image_view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_view_info.subresourceRange.baseMipLevel = 0;
+    image_view_info.subresourceRange.levelCount = mip_levels;
+    image_view_info.subresourceRange.baseArrayLayer = 0;
+    image_view_info.subresourceRange.layerCount = 1;
+
+    VK_CHECK(vkCreateImageView(gctx->device, &image_view_info, nullptr, &image_view));
+
+    return texture(image, image_view, { texture_descriptor_type::storage_image, texture_descriptor_type::sampled_image },
+        nullptr, 0, mip_levels);
+}
 
-    vkCmdPipelineBarrier(graph.command_buffer_, ptr->last_used_, 
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_barrier);
+texture make_texture_level_view(const texture &t, u32 level, VkImageViewType view_type, VkFormat format) {
+    VkImageView image_view;
 
-    ptr->last_used_ = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-    ptr->last_used_type_ = converted_type;
-    ptr->last_layout_ = image_barrier.newLayout;
+    VkImageViewCreateInfo image_view_info = {};
+    image_view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    image_view_info.image = t.image_;
+    image_view_info.viewType = view_type;
+    image_view_info.format = format;
+    image_view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_view_info.subresourceRange.baseMipLevel = level;
+    image_view_info.subresourceRange.levelCount = 1;
+    image_view_info.subresourceRange.baseArrayLayer = 0;
+    image_view_info.subresourceRange.layerCount = 1;
+
+    VK_CHECK(vkCreateImageView(gctx->device, &image_view_info, nullptr, &image_view));
+
+    return texture(t.image_, image_view, { texture_descriptor_type::storage_image }, t.levels_, level, 1);
+}
+
+
+texture_sampler::texture_sampler()
+: sampler_(VK_NULL_HANDLE), descriptor_set_(VK_NULL_HANDLE) {
+
+}
+
+texture_sampler::texture_sampler(VkSampler sampler)
+: sampler_(sampler) {
+    VkDescriptorSetLayout layout = get_descriptor_set_layout(VK_DESCRIPTOR_TYPE_SAMPLER, 1);
+
+    VkDescriptorSetAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.descriptorPool = gctx->descriptor_pool;
+    allocate_info.descriptorSetCount = 1;
+    allocate_info.pSetLayouts = &layout;
+
+    vkAllocateDescriptorSets(gctx->device, &allocate_info, &descriptor_set_);
+
+    VkDescriptorImageInfo image_info = {};
+    image_info.sampler = sampler_;
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptor_set_;
+    write.dstBinding = 0;
+    write.dstArrayElement = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    write.pImageInfo = &image_info;
+
+    vkUpdateDescriptorSets(gctx->device, 1, &write, 0, nullptr);
+}
+
+VkDescriptorSet texture_sampler::get_descriptor_set(VkDescriptorType type) {
+    return descriptor_set_;
+}
+
+u32 texture_sampler::convert_descriptor_type_vk_(VkDescriptorType type) {
+    if (type != VK_DESCRIPTOR_TYPE_SAMPLER) {
+        log_error("Samplers can only be bound as VK_DESCRIPTOR_TYPE_SAMPLER");
+        panic_and_exit();
+    }
+
+    return 0;
+}
+
+void texture_sampler::prepare_compute_resource_(render_graph &graph, VkDescriptorType type, void *) {
+
+}
+
+VkDescriptorSet *texture_sampler::get_descriptor_sets() {
+    return &descriptor_set_;
+}
+
+texture_sampler make_linear_sampler() {
+    VkSamplerCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    info.magFilter = VK_FILTER_LINEAR;
+    info.minFilter = VK_FILTER_LINEAR;
+    info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    info.maxLod = 0.0f;
+
+    VkSampler sampler;
+    VK_CHECK(vkCreateSampler(gctx->device, &info, nullptr, &sampler));
+
+    return texture_sampler(sampler);
 }
@@ -2,6 +2,7 @@
 
 #include "uniform.hpp"
 #include "heap_array.hpp"
+#include <initializer_list>
 #include "render_graph.hpp"
 
 #include <vulkan/vulkan.h>
@@ -10,12 +11,24 @@ enum class texture_descriptor_type : u32 {
     sampled_image, storage_image, input_attachment, max_enum
 };
 
+// Layout and last stage of one mip level. Shared by every view of the
+// image, so barriers from different views agree on what the level is in
+struct texture_level_state {
+    VkPipelineStageFlags last_used;
+    VkImageLayout last_layout;
+};
+
 class texture : public uobject {
 public:
     // Construction
     texture();
     texture(VkImage image, VkImageView image_view, bool is_depth = false);
     texture(VkImage image, VkImageView image_view, texture_descriptor_type type, bool is_depth = false);
+    texture(VkImage image, VkImageView image_view, std::initializer_list<texture_descriptor_type> types, bool is_depth = false);
+    // View of the levels [base_level, base_level + level_count) of an image with
+    // mips, levels is the state of the whole image (nullptr makes a new one)
+    texture(VkImage image, VkImageView image_view, std::initializer_list<texture_descriptor_type> types,
+        texture_level_state *levels, u32 base_level, u32 level_count);
 
     texture &operator=(const texture &other);
 
@@ -33,6 +46,11 @@ private:
     // This returns all the descriptor sets
     VkDescriptorSet *get_descriptor_sets();
 
+    void make_descriptor_set_(texture_descriptor_type type);
+    void allocate_levels_(u32 level_count);
+    // One barrier per level of this view, they can all be in different layouts
+    void add_level_barriers_(render_graph &graph, VkImageLayout dst, VkPipelineStageFlags stage, bool is_deferred);
+
 private:
     VkImage image_;
     VkImageView image_view_;
@@ -40,11 +58,47 @@ private:
     // Table - these will always be created for all images
     VkDescriptorSet descriptor_set_[(u32)texture_descriptor_type::max_enum];
 
-    VkPipelineStageFlags last_used_;
+    texture_level_state *levels_;
+    u32 base_level_;
+    u32 level_count_;
     texture_descriptor_type last_used_type_;
-    VkImageLayout last_layout_;
 
     bool is_depth_;
 
+    friend class compute_pass;
+    friend texture make_texture_level_view(const texture &, u32, VkImageViewType, VkFormat);
+};
+
+// Creates a device local 2D image that shaders can write to
+texture make_storage_texture(u32 width, u32 height, VkFormat format);
+// Device local 3D image, written as a storage image and read through a sampler
+texture make_storage_texture_3d(u32 width, u32 height, u32 depth, VkFormat format, u32 mip_levels = 1);
+// Storage image view of a single mip level, for the passes which write the levels.
+// Barriers through either view see the same per-level layouts
+texture make_texture_level_view(const texture &t, u32 level, VkImageViewType view_type, VkFormat format);
+
+// Bound as its own descriptor set and combined with a sampled_image texture
+// in the shader (sampler3D(image, sampler))
+class texture_sampler : public uobject {
+public:
+    texture_sampler();
+    texture_sampler(VkSampler sampler);
+
+    VkDescriptorSet get_descriptor_set(VkDescriptorType type) override;
+
+private:
+    static u32 convert_descriptor_type_vk_(VkDescriptorType type);
+    // Nothing to synchronize
+    static void prepare_compute_resource_(render_graph &graph, VkDescriptorType type, void *);
+
+    VkDescriptorSet *get_descriptor_sets();
+
+private:
+    VkSampler sampler_;
+    VkDescriptorSet descriptor_set_;
+
     friend class compute_pass;
 };
+
+// Trilinear, clamped to the edges
+texture_sampler make_linear_sampler();